@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include "log.h"
+#include "arena.h"
+
+#define ARENA_ALIGN	 16
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+typedef struct arena_chunk_s {
+	size_t		     size;	/* Size of the chunk's data */
+	size_t		     used;	/* Allocated bytes */
+	struct arena_chunk_s *next;
+} arena_chunk_t;
+
+/*
+ * The data of a chunk follows its header, aligned to ARENA_ALIGN.
+ */
+#define CHUNK_HDR_SIZE	 roundup2(sizeof(arena_chunk_t), ARENA_ALIGN)
+#define CHUNK_DATA(c)	 ((char *)(c) + CHUNK_HDR_SIZE)
+
+struct arena_s {
+	arena_chunk_t *chunks;	/* Current chunk first */
+};
+
+arena_t *
+create_arena()
+{
+	arena_t *arena;
+
+	if ((arena = malloc(sizeof(arena_t))) == NULL)
+		die("malloc()");
+	arena->chunks = NULL;
+
+	return (arena);
+}
+
+void
+free_arena(arena_t *arena)
+{
+	arena_chunk_t *c, *next;
+
+	if (arena == NULL)
+		return;
+	for (c = arena->chunks; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(arena);
+}
+
+/*
+ * Returns zero-filled memory of the given size from the arena.
+ */
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+	char	      *p;
+	size_t	      csize;
+	arena_chunk_t *c;
+
+	size = roundup2(size, ARENA_ALIGN);
+	c = arena->chunks;
+	if (c == NULL || c->used + size > c->size) {
+		csize = MAX(size, ARENA_CHUNK_SIZE);
+		if ((c = malloc(CHUNK_HDR_SIZE + csize)) == NULL)
+			die("malloc()");
+		c->size = csize;
+		c->used = 0;
+		if (size < ARENA_CHUNK_SIZE || arena->chunks == NULL) {
+			c->next = arena->chunks;
+			arena->chunks = c;
+		} else {
+			/*
+			 * Keep the current chunk in front, so its free
+			 * space is still used.
+			 */
+			c->next = arena->chunks->next;
+			arena->chunks->next = c;
+		}
+	}
+	p = CHUNK_DATA(c) + c->used;
+	c->used += size;
+	(void)memset(p, 0, size);
+
+	return (p);
+}
+
+char *
+arena_strdup(arena_t *arena, const char *str)
+{
+	char   *p;
+	size_t len;
+
+	len = strlen(str) + 1;
+	p = arena_alloc(arena, len);
+	(void)memcpy(p, str, len);
+
+	return (p);
+}
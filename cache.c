@@ -0,0 +1,431 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "log.h"
+#include "cache.h"
+
+#define CACHE_HEADER "# " PROGRAM " cache 1"
+#define CACHE_BUCKETS 256
+
+/*
+ * Modification time and size of a file the cached data depends on. Both
+ * are -1 if the file doesn't exist.
+ */
+typedef struct cache_dep_s {
+	char	 *path;
+	intmax_t mtime;
+	intmax_t size;
+} cache_dep_t;
+
+struct dev_cache_s {
+	bool	    dirty;	/* Must be written */
+	char	    *path;
+	cache_dep_t *deps;
+	size_t	    ndeps;
+	devlist_t   *devs;	/* Cached devices */
+	devinfo_t   *bucket[CACHE_BUCKETS]; /* Cached devices by identity */
+};
+
+static int	 read_dev_cache(dev_cache_t *);
+static int	 mkparentdir(const char *);
+static bool	 same_identity(const devinfo_t *, const devinfo_t *);
+static void	 index_entry(dev_cache_t *, devinfo_t *);
+static uint32_t	 hash_identity(const devinfo_t *);
+static void	 stat_dep(cache_dep_t *, const char *);
+static void	 clear_entries(dev_cache_t *);
+static devinfo_t *find_entry(const dev_cache_t *, const devinfo_t *);
+
+/*
+ * Opens the cache file at path. deps is a NULL-terminated list of files
+ * the cached data depends on. If the cache file doesn't exist, or any of
+ * the dependencies changed, the cache starts out empty.
+ */
+dev_cache_t *
+open_dev_cache(const char *path, const char **deps)
+{
+	size_t	    i;
+	dev_cache_t *cache;
+
+	if ((cache = malloc(sizeof(dev_cache_t))) == NULL)
+		die("malloc()");
+	(void)memset(cache, 0, sizeof(dev_cache_t));
+	if ((cache->path = strdup(path)) == NULL)
+		die("strdup()");
+	for (cache->ndeps = 0; deps[cache->ndeps] != NULL; cache->ndeps++)
+		;
+	if ((cache->deps = malloc(cache->ndeps * sizeof(cache_dep_t))) == NULL)
+		die("malloc()");
+	for (i = 0; i < cache->ndeps; i++)
+		stat_dep(&cache->deps[i], deps[i]);
+	cache->devs = create_devlist();
+	if (read_dev_cache(cache) == -1) {
+		clear_entries(cache);
+		cache->dirty = true;
+	}
+	return (cache);
+}
+
+void
+free_dev_cache(dev_cache_t *cache)
+{
+	size_t i;
+
+	if (cache == NULL)
+		return;
+	free_devlist(cache->devs);
+	for (i = 0; i < cache->ndeps; i++)
+		free(cache->deps[i].path);
+	free(cache->deps);
+	free(cache->path);
+	free(cache);
+}
+
+/*
+ * Looks up the given device in the cache. If found, its driver list and,
+ * if cached, its description are set, and true is returned.
+ */
+bool
+lookup_dev_cache(const dev_cache_t *cache, devinfo_t *dev)
+{
+	int	  i;
+	devinfo_t *entry;
+
+	if ((entry = find_entry(cache, dev)) == NULL)
+		return (false);
+	for (i = 0; i < entry->ndrivers; i++)
+		add_driver(dev, entry->drivers[i]);
+	if (entry->descr_resolved && !dev->descr_resolved) {
+		dev->descr_resolved = true;
+		if (entry->descr != NULL)
+			set_devdescr(dev, entry->descr);
+	}
+	return (true);
+}
+
+/*
+ * Adds the given device with its driver list and description to the
+ * cache, or adds the description to an existing entry.
+ */
+void
+update_dev_cache(dev_cache_t *cache, const devinfo_t *dev)
+{
+	int	  i;
+	devinfo_t *entry;
+
+	if ((entry = find_entry(cache, dev)) == NULL) {
+		entry = add_device(cache->devs);
+		entry->bus	 = dev->bus;
+		entry->vendor	 = dev->vendor;
+		entry->device	 = dev->device;
+		entry->subvendor = dev->subvendor;
+		entry->subdevice = dev->subdevice;
+		entry->class	 = dev->class;
+		entry->subclass	 = dev->subclass;
+		entry->revision	 = dev->revision;
+		for (i = 0; i < dev->nifaces; i++) {
+			add_iface(entry, dev->iface[i].class,
+			    dev->iface[i].subclass, dev->iface[i].protocol);
+		}
+		for (i = 0; i < dev->ndrivers; i++)
+			add_driver(entry, dev->drivers[i]);
+		index_entry(cache, entry);
+		cache->dirty = true;
+	}
+	if (dev->descr_resolved && !entry->descr_resolved) {
+		entry->descr_resolved = true;
+		if (dev->descr != NULL)
+			set_devdescr(entry, dev->descr);
+		cache->dirty = true;
+	}
+}
+
+/*
+ * Writes the cache to its file if it was changed. The file is written
+ * to a temporary file first, which is then renamed.
+ */
+int
+write_dev_cache(dev_cache_t *cache)
+{
+	int	  i, saved_errno;
+	FILE	  *fp;
+	char	  tmppath[PATH_MAX];
+	size_t	  n;
+	devinfo_t *d;
+
+	if (!cache->dirty)
+		return (0);
+	if (mkparentdir(cache->path) == -1)
+		return (-1);
+	(void)snprintf(tmppath, sizeof(tmppath), "%s.tmp", cache->path);
+	if ((fp = fopen(tmppath, "w")) == NULL)
+		return (-1);
+	(void)fprintf(fp, "%s\n", CACHE_HEADER);
+	for (n = 0; n < cache->ndeps; n++) {
+		(void)fprintf(fp, "dep %jd %jd %s\n", cache->deps[n].mtime,
+		    cache->deps[n].size, cache->deps[n].path);
+	}
+	for (n = 0; n < cache->devs->ndevs; n++) {
+		d = cache->devs->devs[n];
+		(void)fprintf(fp, "dev %x %x %x %x %x %x %x %x\n", d->bus,
+		    d->vendor, d->device, d->subvendor, d->subdevice,
+		    d->class, d->subclass, d->revision);
+		for (i = 0; i < d->nifaces; i++) {
+			(void)fprintf(fp, "iface %x %x %x\n",
+			    d->iface[i].class, d->iface[i].subclass,
+			    d->iface[i].protocol);
+		}
+		if (d->descr_resolved && d->descr != NULL)
+			(void)fprintf(fp, "descr %s\n", d->descr);
+		else if (d->descr_resolved)
+			(void)fprintf(fp, "nodescr\n");
+		for (i = 0; i < d->ndrivers; i++)
+			(void)fprintf(fp, "driver %s\n", d->drivers[i]);
+	}
+	if (ferror(fp))
+		goto error;
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		goto error;
+	}
+	if (rename(tmppath, cache->path) == -1) {
+		fp = NULL;
+		goto error;
+	}
+	cache->dirty = false;
+
+	return (0);
+error:
+	saved_errno = errno;
+	if (fp != NULL)
+		(void)fclose(fp);
+	(void)unlink(tmppath);
+	errno = saved_errno;
+
+	return (-1);
+}
+
+/*
+ * Reads the cache file. Returns -1 if the file doesn't exist, is invalid,
+ * or was written for different dependencies.
+ */
+static int
+read_dev_cache(dev_cache_t *cache)
+{
+	int	     n;
+	FILE	     *fp;
+	char	     ln[_POSIX2_LINE_MAX], *p;
+	size_t	     i, ndeps;
+	intmax_t     mtime, size;
+	unsigned int id[8];
+	devinfo_t    *d;
+	cache_dep_t  *dep;
+
+	if ((fp = fopen(cache->path, "r")) == NULL)
+		return (-1);
+	d = NULL; ndeps = 0;
+	if (fgets(ln, sizeof(ln), fp) == NULL)
+		goto invalid;
+	ln[strcspn(ln, "\n")] = '\0';
+	if (strcmp(ln, CACHE_HEADER) != 0)
+		goto invalid;
+	while (fgets(ln, sizeof(ln), fp) != NULL) {
+		if ((p = strchr(ln, '\n')) == NULL)
+			goto invalid;
+		*p = '\0';
+		if (strncmp(ln, "dep ", 4) == 0) {
+			if (d != NULL || ndeps >= cache->ndeps)
+				goto invalid;
+			dep = &cache->deps[ndeps++];
+			if (sscanf(ln, "dep %jd %jd %n", &mtime, &size, &n) < 2 ||
+			    strcmp(ln + n, dep->path) != 0 ||
+			    mtime != dep->mtime || size != dep->size)
+				goto invalid;
+		} else if (strncmp(ln, "dev ", 4) == 0) {
+			if (ndeps != cache->ndeps)
+				goto invalid;
+			if (sscanf(ln, "dev %x %x %x %x %x %x %x %x", &id[0],
+			    &id[1], &id[2], &id[3], &id[4], &id[5], &id[6],
+			    &id[7]) != 8)
+				goto invalid;
+			d = add_device(cache->devs);
+			d->bus	     = id[0];
+			d->vendor    = id[1];
+			d->device    = id[2];
+			d->subvendor = id[3];
+			d->subdevice = id[4];
+			d->class     = id[5];
+			d->subclass  = id[6];
+			d->revision  = id[7];
+		} else if (d == NULL) {
+			goto invalid;
+		} else if (strncmp(ln, "iface ", 6) == 0) {
+			if (sscanf(ln, "iface %x %x %x", &id[0], &id[1],
+			    &id[2]) != 3)
+				goto invalid;
+			add_iface(d, id[0], id[1], id[2]);
+		} else if (strncmp(ln, "descr ", 6) == 0) {
+			d->descr_resolved = true;
+			set_devdescr(d, ln + 6);
+		} else if (strcmp(ln, "nodescr") == 0) {
+			d->descr_resolved = true;
+		} else if (strncmp(ln, "driver ", 7) == 0) {
+			add_driver(d, ln + 7);
+		} else
+			goto invalid;
+	}
+	if (ndeps != cache->ndeps)
+		goto invalid;
+	(void)fclose(fp);
+	for (i = 0; i < cache->devs->ndevs; i++)
+		index_entry(cache, cache->devs->devs[i]);
+
+	return (0);
+invalid:
+	(void)fclose(fp);
+	return (-1);
+}
+
+static devinfo_t *
+find_entry(const dev_cache_t *cache, const devinfo_t *dev)
+{
+	devinfo_t *entry;
+
+	for (entry = cache->bucket[hash_identity(dev)]; entry != NULL;
+	    entry = entry->hnext) {
+		if (same_identity(entry, dev))
+			return (entry);
+	}
+	return (NULL);
+}
+
+/*
+ * Adds the given entry to the hash bucket of its identity. The entry's
+ * interfaces must be complete. Cache entries have no location, so their
+ * hnext pointer is not used by the device list.
+ */
+static void
+index_entry(dev_cache_t *cache, devinfo_t *entry)
+{
+	uint32_t h;
+
+	h = hash_identity(entry);
+	entry->hnext = cache->bucket[h];
+	cache->bucket[h] = entry;
+}
+
+static uint32_t
+hash_identity(const devinfo_t *dev)
+{
+	int	 i;
+	size_t	 n;
+	uint32_t h;
+	uint16_t id[9] = {
+		dev->bus, dev->vendor, dev->device, dev->subvendor,
+		dev->subdevice, dev->class, dev->subclass, dev->revision,
+		dev->nifaces
+	};
+
+	/* FNV-1a */
+	for (h = 2166136261U, n = 0; n < sizeof(id) / sizeof(id[0]); n++)
+		h = (h ^ id[n]) * 16777619U;
+	for (i = 0; i < dev->nifaces; i++) {
+		h = (h ^ dev->iface[i].class) * 16777619U;
+		h = (h ^ dev->iface[i].subclass) * 16777619U;
+		h = (h ^ dev->iface[i].protocol) * 16777619U;
+	}
+	return (h & (CACHE_BUCKETS - 1));
+}
+
+static bool
+same_identity(const devinfo_t *d1, const devinfo_t *d2)
+{
+	int i;
+
+	if (d1->bus != d2->bus || d1->vendor != d2->vendor ||
+	    d1->device != d2->device || d1->subvendor != d2->subvendor ||
+	    d1->subdevice != d2->subdevice || d1->class != d2->class ||
+	    d1->subclass != d2->subclass || d1->revision != d2->revision ||
+	    d1->nifaces != d2->nifaces)
+		return (false);
+	for (i = 0; i < d1->nifaces; i++) {
+		if (d1->iface[i].class != d2->iface[i].class ||
+		    d1->iface[i].subclass != d2->iface[i].subclass ||
+		    d1->iface[i].protocol != d2->iface[i].protocol)
+			return (false);
+	}
+	return (true);
+}
+
+static void
+stat_dep(cache_dep_t *dep, const char *path)
+{
+	struct stat sb;
+
+	if ((dep->path = strdup(path)) == NULL)
+		die("strdup()");
+	if (stat(path, &sb) == -1) {
+		dep->mtime = dep->size = -1;
+		return;
+	}
+	dep->mtime = sb.st_mtime;
+	dep->size  = sb.st_size;
+}
+
+static void
+clear_entries(dev_cache_t *cache)
+{
+	free_devlist(cache->devs);
+	cache->devs = create_devlist();
+	(void)memset(cache->bucket, 0, sizeof(cache->bucket));
+}
+
+/*
+ * Creates the directory containing path if it doesn't exist.
+ */
+static int
+mkparentdir(const char *path)
+{
+	char	    buf[PATH_MAX], *dir;
+	struct stat sb;
+
+	(void)strlcpy(buf, path, sizeof(buf));
+	if ((dir = dirname(buf)) == NULL)
+		return (-1);
+	if (stat(dir, &sb) == 0)
+		return (0);
+	if (errno != ENOENT || mkdir(dir, 0755) == -1)
+		return (-1);
+	return (0);
+}
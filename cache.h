@@ -0,0 +1,44 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+#include <sys/types.h>
+#include <stdbool.h>
+
+#include "device.h"
+
+/*
+ * Cache of device descriptions and driver lists, keyed by the device
+ * identity. The cache is only valid as long as the files it depends on
+ * are unchanged.
+ */
+typedef struct dev_cache_s dev_cache_t;
+
+extern int	   write_dev_cache(dev_cache_t *);
+extern bool	   lookup_dev_cache(const dev_cache_t *, devinfo_t *);
+extern void	   update_dev_cache(dev_cache_t *, const devinfo_t *);
+extern void	   free_dev_cache(dev_cache_t *);
+extern dev_cache_t *open_dev_cache(const char *, const char **);
+#endif
@@ -34,9 +34,34 @@
 static void setint_tbl_field(lua_State *, const char *, int);
 static void setstr_tbl_field(lua_State *, const char *, const char *);
 static void add_interface_tbl(lua_State *, const iface_t *);
-static void dev_to_tbl(lua_State *, const devinfo_t *dev);
+static void dev_to_tbl(lua_State *, devinfo_t *dev);
+static int  index_dev_tbl(lua_State *);
+static int  getint(lua_State *, const char *);
 static char **getstrarr(lua_State *, const char *, size_t *);
 
+/*
+ * Returns the value of the given non-negative integer variable, or -1 if
+ * it is not set.
+ */
+static int
+getint(lua_State *L, const char *var)
+{
+	int val;
+
+	lua_getglobal(L, var);
+	if (lua_isnil(L, -1))
+		val = -1;
+	else if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) < 0) {
+		logprintx("Syntax error: '%s' is not a non-negative integer",
+		    var);
+		val = -1;
+	} else
+		val = lua_tointeger(L, -1);
+	lua_pop(L, 1);
+
+	return (val);
+}
+
 static char **
 getstrarr(lua_State *L, const char *var, size_t *len)
 {
@@ -90,17 +115,47 @@ add_interface_tbl(lua_State *L, const iface_t *iface)
 	setint_tbl_field(L, "protocol", iface->protocol);
 }
 
+/*
+ * __index metamethod of device tables. Looks up the device description
+ * when the "descr" field is read for the first time.
+ */
+static int
+index_dev_tbl(lua_State *L)
+{
+	devinfo_t  *dev;
+	const char *descr;
+
+	if (lua_type(L, 2) != LUA_TSTRING ||
+	    strcmp(lua_tostring(L, 2), "descr") != 0)
+		return (0);
+	if (!lua_getmetatable(L, 1))
+		return (0);
+	lua_getfield(L, -1, "dev");
+	dev = lua_touserdata(L, -1);
+	lua_pop(L, 2);
+	if (dev == NULL || (descr = resolve_devdescr(dev)) == NULL)
+		return (0);
+	lua_pushstring(L, descr);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, 1, "descr");
+
+	return (1);
+}
+
 /*
  * Create a Lua table from the given devinfo_t * object, and push it on the
- * Lua stack.
+ * Lua stack. The "descr" field is resolved on first access via a metatable
+ * which refers to the device.
  */
 static void
-dev_to_tbl(lua_State *L, const devinfo_t *dev)
+dev_to_tbl(lua_State *L, devinfo_t *dev)
 {
 	int i;
 
 	lua_newtable(L);
 	setint_tbl_field(L, "bus", dev->bus);
+	setstr_tbl_field(L, "ugen", dev->ugen);
+	setstr_tbl_field(L, "serial", dev->serial);
 	setint_tbl_field(L, "vendor", dev->vendor);
 	setint_tbl_field(L, "device", dev->device);
 	setint_tbl_field(L, "subvendor", dev->subvendor);
@@ -109,7 +164,6 @@ dev_to_tbl(lua_State *L, const devinfo_t *dev)
 	setint_tbl_field(L, "subclass", dev->subclass);
 	setint_tbl_field(L, "revision", dev->revision);
 	setint_tbl_field(L, "nifaces", dev->nifaces);
-	setstr_tbl_field(L, "descr", dev->descr);
 	setint_tbl_field(L, "ndrivers", dev->ndrivers);
 
 	lua_newtable(L);
@@ -124,15 +178,23 @@ dev_to_tbl(lua_State *L, const devinfo_t *dev)
 		lua_rawseti(L, -2, i + 1);
 	}
 	lua_setfield(L, -2, "iface");
+
+	lua_newtable(L);
+	lua_pushlightuserdata(L, dev);
+	lua_setfield(L, -2, "dev");
+	lua_pushcfunction(L, index_dev_tbl);
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
 }
 
 int
-call_cfg_function(config_t *cfg, const char *fname, const devinfo_t *dev,
+call_cfg_function(config_t *cfg, const char *fname, devinfo_t *dev,
 	const char *kmod)
 {
-	int error, nargs = 0;
+	int  error, nargs = 0;
+	bool has_mt;
 
-	error = -1;
+	error = -1; has_mt = false;
 	if (cfg->luastate == NULL)
 		return (-1);
 	lua_getglobal(cfg->luastate, fname);
@@ -145,6 +207,13 @@ call_cfg_function(config_t *cfg, const char *fname, const devinfo_t *dev,
 	if (dev != NULL) {
 		/* Push the given devinfo_t * object onto the Lua stack. */
 		dev_to_tbl(cfg->luastate, dev);
+		/*
+		 * Keep the table's metatable below the function, so that its
+		 * device reference can be cleared after the call.
+		 */
+		(void)lua_getmetatable(cfg->luastate, -1);
+		lua_insert(cfg->luastate, 1);
+		has_mt = true;
 	}
 	if (strcmp(fname, "on_load_kmod") == 0 ||
 	    strcmp(fname, "affirm") == 0) {
@@ -160,6 +229,11 @@ call_cfg_function(config_t *cfg, const char *fname, const devinfo_t *dev,
 	}
 	error = lua_tointeger(cfg->luastate, -1);
 out:
+	if (has_mt) {
+		/* The device table must not refer to dev after the call. */
+		lua_pushnil(cfg->luastate);
+		lua_setfield(cfg->luastate, 1, "dev");
+	}
 	lua_settop(cfg->luastate, 0);
 
 	return (error);
@@ -188,6 +262,8 @@ open_cfg(const char *path, bool init)
 		call_cfg_function(cfg, "init", NULL, NULL);
 	cfg->exclude = getstrarr(cfg->luastate, "exclude_kmods",
 	    &cfg->exclude_len);
+	cfg->attach_wait = getint(cfg->luastate, "attach_wait");
+	cfg->attach_wait_max = getint(cfg->luastate, "attach_wait_max");
 
 	return (cfg);
 }
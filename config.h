@@ -33,10 +33,12 @@
 typedef struct config_s {
 	char	  **exclude;   /* List of modules to exclude */
 	size_t	  exclude_len; /* Length of exclude list */
+	int	  attach_wait;	   /* Quiet window for ATTACH events (ms) */
+	int	  attach_wait_max; /* Max. delay of ATTACH events (ms) */
 	lua_State *luastate;
 } config_t;
 
-extern int	call_cfg_function(config_t *, const char *, const devinfo_t *,
+extern int	call_cfg_function(config_t *, const char *, devinfo_t *,
 			const char *);
 extern config_t	*open_cfg(const char *, bool);
 #endif
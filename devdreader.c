@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "log.h"
+#include "devdreader.h"
+
+#define MSG_SIZE  1024		/* Initial space reserved per message */
+#define MIN_BUFSZ (4 * MSG_SIZE)
+#define MAX_BATCH 32		/* Max. # of messages per recvmmsg() */
+#define MAX_MSGS  256		/* Max. # of messages in the ring */
+
+typedef struct devd_msg_s {
+	size_t off;		/* Offset of the message in the ring buffer */
+	size_t len;
+} devd_msg_t;
+
+/*
+ * The buffer holds the received messages from head to tail, and may wrap
+ * around. Each message is followed by a '\0'.
+ */
+struct devd_reader_s {
+	int	       fd;
+	char	       *buf;		/* Ring buffer */
+	size_t	       bufsz;
+	size_t	       msgsz;		/* Space reserved per message */
+	size_t	       head;		/* Offset of the oldest message */
+	size_t	       tail;		/* Offset after the newest message */
+	size_t	       first;		/* Index of the oldest message in msgs */
+	size_t	       nmsgs;		/* # of messages in the ring */
+	bool	       lost;		/* Messages were dropped */
+	devd_msg_t     msgs[MAX_MSGS];
+	struct iovec   iov[MAX_BATCH];
+	struct mmsghdr hdr[MAX_BATCH];
+};
+
+static bool   grow_buf(devd_reader_t *);
+static size_t reserve_slots(devd_reader_t *);
+
+devd_reader_t *
+open_devd_reader(int fd)
+{
+	int	      rcvbuf;
+	socklen_t     optlen;
+	devd_reader_t *r;
+
+	if ((r = malloc(sizeof(devd_reader_t))) == NULL)
+		return (NULL);
+	(void)memset(r, 0, sizeof(devd_reader_t));
+	optlen = sizeof(rcvbuf);
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) == -1)
+		rcvbuf = 0;
+	r->fd	 = fd;
+	r->msgsz = MSG_SIZE;
+	r->bufsz = rcvbuf > MIN_BUFSZ ? rcvbuf : MIN_BUFSZ;
+	if ((r->buf = malloc(r->bufsz)) == NULL) {
+		free(r);
+		return (NULL);
+	}
+	return (r);
+}
+
+void
+free_devd_reader(devd_reader_t *r)
+{
+	if (r == NULL)
+		return;
+	free(r->buf);
+	free(r);
+}
+
+/*
+ * Receives the pending messages into the ring buffer. Returns the number
+ * of received messages, or 0 if there are no pending messages or the ring
+ * is full. Returns -1 on error, and sets errno to ECONNRESET if the
+ * connection was closed. Truncated messages are dropped, and the space
+ * reserved for further messages is increased.
+ */
+int
+read_devd_msgs(devd_reader_t *r)
+{
+	int	   i, n, nrecvd;
+	size_t	   nslots, len;
+	devd_msg_t *msg;
+
+	if (r->nmsgs == 0 && r->msgsz > r->bufsz / 4 && !grow_buf(r))
+		return (-1);
+	if ((nslots = reserve_slots(r)) == 0)
+		return (0);
+	while ((n = recvmmsg(r->fd, r->hdr, nslots, 0, NULL)) == -1) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return (0);
+		if (errno != EINTR)
+			return (-1);
+	}
+	for (i = nrecvd = 0; i < n; i++) {
+		if ((len = r->hdr[i].msg_len) == 0) {
+			/* Connection closed by peer. */
+			if (i == 0) {
+				errno = ECONNRESET;
+				return (-1);
+			}
+			break;
+		}
+		r->tail = (char *)r->iov[i].iov_base - r->buf + len + 1;
+		if (r->hdr[i].msg_hdr.msg_flags & MSG_TRUNC) {
+			logprintx("recvmmsg(): Message truncated");
+			r->lost = true;
+			if (r->msgsz < r->bufsz)
+				r->msgsz *= 2;
+			continue;
+		}
+		msg = &r->msgs[(r->first + r->nmsgs++) % MAX_MSGS];
+		msg->off = r->tail - len - 1;
+		msg->len = len;
+		r->buf[msg->off + len] = '\0';
+		nrecvd++;
+	}
+	if (r->nmsgs == 0)
+		r->head = r->tail = 0;
+	return (nrecvd);
+}
+
+/*
+ * Returns true if truncated messages were dropped since the last call.
+ */
+bool
+devd_msgs_lost(devd_reader_t *r)
+{
+	bool lost;
+
+	lost = r->lost;
+	r->lost = false;
+
+	return (lost);
+}
+
+/*
+ * Returns a pointer to the oldest message, and removes it from the ring.
+ * The message is '\0'-terminated, and may be modified by the caller. It is
+ * valid until the next call of read_devd_msgs(). If len is not NULL, it
+ * is set to the length of the message.
+ */
+char *
+next_devd_msg(devd_reader_t *r, size_t *len)
+{
+	devd_msg_t *msg;
+
+	if (r->nmsgs == 0)
+		return (NULL);
+	msg = &r->msgs[r->first];
+	r->first = (r->first + 1) % MAX_MSGS;
+	if (--r->nmsgs == 0)
+		r->head = r->tail = 0;
+	else
+		r->head = r->msgs[r->first].off;
+	if (len != NULL)
+		*len = msg->len;
+	return (r->buf + msg->off);
+}
+
+/*
+ * Sets up an iovec of msgsz bytes for each message that fits into the free
+ * space of the ring, and returns their number.
+ */
+static size_t
+reserve_slots(devd_reader_t *r)
+{
+	bool   wrapped;
+	size_t n, pos;
+
+	wrapped = r->tail < r->head;
+	for (n = 0, pos = r->tail; n < MAX_BATCH &&
+	    r->nmsgs + n < MAX_MSGS; n++, pos += r->msgsz) {
+		if (!wrapped && pos + r->msgsz > r->bufsz) {
+			/* Wrap around if there is space before the head. */
+			wrapped = true;
+			pos = 0;
+		}
+		/* Keep tail and head apart, unless the ring is empty. */
+		if (wrapped && pos + r->msgsz >= r->head)
+			break;
+		r->iov[n].iov_base = r->buf + pos;
+		r->iov[n].iov_len  = r->msgsz - 1;
+		(void)memset(&r->hdr[n], 0, sizeof(r->hdr[n]));
+		r->hdr[n].msg_hdr.msg_iov    = &r->iov[n];
+		r->hdr[n].msg_hdr.msg_iovlen = 1;
+	}
+	return (n);
+}
+
+/*
+ * Doubles the size of the empty ring buffer, so messages grown beyond
+ * the reserved space still fit.
+ */
+static bool
+grow_buf(devd_reader_t *r)
+{
+	char *p;
+
+	if ((p = realloc(r->buf, r->bufsz * 2)) == NULL)
+		return (false);
+	r->buf	  = p;
+	r->bufsz *= 2;
+	r->head	  = r->tail = 0;
+
+	return (true);
+}
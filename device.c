@@ -25,195 +25,442 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/param.h>
 #include <sys/types.h>
-#include <sys/pciio.h>
 #include <unistd.h>
+#include <sys/pciio.h>
 #include <libusb20_desc.h>
 #include <libusb20.h>
 
 #include "log.h"
 #include "device.h"
 #include "config.h"
+#include "iddb.h"
+#include "replay.h"
+#include "sysfs.h"
 
 #define PATH_PCI     "/dev/pci"
-#define MAX_PCI_DEVS 32
-
-enum DESCR_DB_COLUMS {
-	DESCR_DB_VENDOR_COLUMN = 1, DESCR_DB_DEVICE_COLUMN, DESCR_DB_SUB_COLUMN
+#define PCI_CONF_BUFSIZE 256	/* Initial # of PCIOCGETCONF results */
+
+static uint32_t hash_location(const char *);
+static const char *dev_location(const devinfo_t *);
+static devinfo_t **get_devs(devlist_t *, int (*)(devlist_t *, const char *));
+static int	 devfs_get_pci_devs(devlist_t *, const char *);
+static int	 devfs_get_usb_devs(devlist_t *, const char *);
+static void	 free_devinfo(devinfo_t *);
+static devinfo_t *append_device(devlist_t *, arena_t *);
+static void	 *dev_alloc(devinfo_t *, size_t);
+static void	 *grow_array(devinfo_t *, void *, size_t, size_t);
+
+static id_db_t	 *pciids, *usbids;	/* Opened on first use */
+
+static const dev_backend_t backends[] = {
+	{ "devfs", devfs_get_pci_devs, devfs_get_usb_devs, NULL },
+	{ "sysfs", sysfs_get_pci_devs, sysfs_get_usb_devs, PATH_SYSFS },
+	{ "replay", replay_get_pci_devs, replay_get_usb_devs, NULL }
 };
-
-static bool	 is_new(devinfo_t **, uint16_t, uint16_t, uint16_t, uint16_t);
-static bool	 match_devdescr_column(const devinfo_t *, char *, int);
-static void	 add_iface(devinfo_t *, uint16_t, uint16_t, uint16_t);
-static char	 *get_next_word_start(char *);
-static devinfo_t *add_device(devinfo_t ***);
+static const dev_backend_t *backend = &backends[0];
+static const char	   *backend_root;	/* NULL for the default */
 
 void
 add_driver(devinfo_t *dev, const char *driver)
 {
-	int i;
+	int  i;
+	char *p;
 
 	for (i = 0; i < dev->ndrivers; i++) {
 		if (strcmp(dev->drivers[i], driver) == 0)
 			return;
 	}
-	dev->drivers = realloc(dev->drivers,
-	    sizeof(char *) * (dev->ndrivers + 1));
-	if (dev->drivers == NULL)
-		die("realloc()");
-	dev->drivers[dev->ndrivers] = strdup(driver);
-	if (dev->drivers[dev->ndrivers] == NULL)
-		die("strdup()");
-	dev->ndrivers++;
+	dev->drivers = grow_array(dev, dev->drivers, dev->ndrivers,
+	    sizeof(char *));
+	p = dev_alloc(dev, strlen(driver) + 1);
+	(void)strcpy(p, driver);
+	dev->drivers[dev->ndrivers++] = p;
 }
 
-static devinfo_t *
-add_device(devinfo_t ***devlist)
+void
+add_iface(devinfo_t *d, uint16_t class, uint16_t subclass, uint16_t protocol)
 {
-	size_t	  len;
-	devinfo_t **list, **p, *dev;
-	
-	if (devlist == NULL)
-		return (NULL);
-	for (len = 0, p = *devlist; p != NULL && *p != NULL; p++)
-		len++;
-	len++;
-	list = realloc(*devlist, sizeof(devinfo_t *) * (len + 1));
+	d->iface = grow_array(d, d->iface, d->nifaces, sizeof(iface_t));
+	d->iface[d->nifaces].class    = class;
+	d->iface[d->nifaces].subclass = subclass;
+	d->iface[d->nifaces].protocol = protocol;
+	d->nifaces++;
+}
+
+void
+set_devdescr(devinfo_t *dev, const char *descr)
+{
+	dev->descr = dev_alloc(dev, strlen(descr) + 1);
+	(void)strcpy(dev->descr, descr);
+}
+
+devlist_t *
+create_devlist()
+{
+	devlist_t *list;
+
+	if ((list = malloc(sizeof(devlist_t))) == NULL)
+		die("malloc()");
+	(void)memset(list, 0, sizeof(devlist_t));
+	list->arena = create_arena();
+
+	return (list);
+}
+
+void
+free_devlist(devlist_t *list)
+{
+	size_t i;
+
 	if (list == NULL)
-		return (NULL);
-	dev = malloc(sizeof(devinfo_t));
-	if (dev == NULL)
-		return (NULL);
-	(void)memset(dev, 0, sizeof(devinfo_t));
-	list[len - 1] = dev;
-	list[len] = NULL;
-	*devlist = list;
+		return;
+	for (i = 0; i < list->ndevs; i++)
+		free_devinfo(list->devs[i]);
+	free_arena(list->arena);
+	free(list->devs);
+	free(list);
+}
+
+/*
+ * Appends a new device to the list. The list grows geometrically.
+ */
+devinfo_t *
+add_device(devlist_t *list)
+{
+	return (append_device(list, list->arena));
+}
+
+/*
+ * Removes the given device from the list. If the device was allocated
+ * from the heap, its memory is freed. Otherwise it is freed with the list.
+ */
+void
+remove_device(devlist_t *list, devinfo_t *dev)
+{
+	size_t	  i;
+	devinfo_t **p;
+
+	for (i = 0; i < list->ndevs && list->devs[i] != dev; i++)
+		;
+	if (i == list->ndevs)
+		return;
+	if (dev_location(dev) != NULL) {
+		for (p = &list->bucket[hash_location(dev_location(dev))];
+		    *p != dev; p = &(*p)->hnext)
+			;
+		*p = dev->hnext;
+	}
+	(void)memmove(&list->devs[i], &list->devs[i + 1],
+	    (list->ndevs - i) * sizeof(devinfo_t *));
+	list->ndevs--;
+	free_devinfo(dev);
+}
+
+/*
+ * Appends a new device, whose data is allocated from the given arena, or
+ * from the heap if arena is NULL.
+ */
+static devinfo_t *
+append_device(devlist_t *list, arena_t *arena)
+{
+	devinfo_t *dev;
+
+	if (list->ndevs + 1 >= list->size) {
+		list->size = list->size == 0 ? 64 : list->size * 2;
+		list->devs = realloc(list->devs,
+		    list->size * sizeof(devinfo_t *));
+		if (list->devs == NULL)
+			die("realloc()");
+	}
+	if (arena != NULL)
+		dev = arena_alloc(arena, sizeof(devinfo_t));
+	else if ((dev = calloc(1, sizeof(devinfo_t))) == NULL)
+		die("calloc()");
+	dev->arena = arena;
+	list->devs[list->ndevs++] = dev;
+	list->devs[list->ndevs] = NULL;
 
 	return (dev);
 }
 
+/*
+ * Frees a device and its data, unless they were allocated from an arena.
+ */
 static void
-add_iface(devinfo_t *d, uint16_t class, uint16_t subclass, uint16_t protocol)
+free_devinfo(devinfo_t *dev)
 {
-	d->iface = realloc(d->iface, sizeof(iface_t) * (d->nifaces + 1));
-	if (d->iface == NULL)
-		die("realloc()");
-	d->iface[d->nifaces].class    = class;
-	d->iface[d->nifaces].subclass = subclass;
-	d->iface[d->nifaces].protocol = protocol;
-	d->nifaces++;
+	int i;
+
+	if (dev->arena != NULL)
+		return;
+	for (i = 0; i < dev->ndrivers; i++)
+		free(dev->drivers[i]);
+	free(dev->drivers);
+	free(dev->iface);
+	free(dev->descr);
+	free(dev->ugen);
+	free(dev->serial);
+	free(dev->pcisel);
+	free(dev);
 }
 
-bool
-match_ifclass(const devinfo_t *d, uint16_t class)
+/*
+ * Allocates memory for the given device's data from its arena, or from
+ * the heap if it has none.
+ */
+static void *
+dev_alloc(devinfo_t *dev, size_t size)
 {
-	int i;
+	void *p;
 
-	for (i = 0; i < d->nifaces; i++) {
-		if (d->iface[i].class == class)
-			return (true);
+	if (dev->arena != NULL)
+		return (arena_alloc(dev->arena, size));
+	if ((p = malloc(size)) == NULL)
+		die("malloc()");
+	return (p);
+}
+
+/*
+ * Makes room for one more element in an array of n elements. The capacity
+ * is doubled whenever n reaches a power of two.
+ */
+static void *
+grow_array(devinfo_t *dev, void *array, size_t n, size_t elsize)
+{
+	void *p;
+
+	if (n != 0 && (n & (n - 1)) != 0)
+		return (array);
+	if (dev->arena == NULL) {
+		if ((p = realloc(array, (n == 0 ? 1 : n * 2) * elsize)) == NULL)
+			die("realloc()");
+		return (p);
 	}
-	return (false);
+	p = arena_alloc(dev->arena, (n == 0 ? 1 : n * 2) * elsize);
+	if (n > 0)
+		(void)memcpy(p, array, n * elsize);
+	return (p);
 }
 
-bool
-match_ifsubclass(const devinfo_t *d, uint16_t subclass)
+static uint32_t
+hash_location(const char *location)
 {
-	int i;
+	uint32_t h;
 
-	for (i = 0; i < d->nifaces; i++) {
-		if (d->iface[i].subclass == subclass)
-			return (true);
+	/* FNV-1a */
+	for (h = 2166136261U; *location != '\0'; location++)
+		h = (h ^ (uint8_t)*location) * 16777619U;
+	return (h & (DEVLIST_BUCKETS - 1));
+}
+
+/*
+ * Returns the ugen name of a USB device, or the selector of a PCI device.
+ * Returns NULL if the device's location is unknown.
+ */
+static const char *
+dev_location(const devinfo_t *dev)
+{
+	return (dev->bus == BUS_TYPE_USB ? dev->ugen : dev->pcisel);
+}
+
+/*
+ * Returns the device with the given location, i.e., ugen name or PCI
+ * selector, or NULL if there is none in the list.
+ */
+devinfo_t *
+find_dev(devlist_t *devlist, const char *location)
+{
+	devinfo_t *dev;
+
+	for (dev = devlist->bucket[hash_location(location)]; dev != NULL;
+	    dev = dev->hnext) {
+		if (strcmp(dev_location(dev), location) == 0)
+			return (dev);
 	}
-	return (false);
+	return (NULL);
 }
 
-bool
-match_ifprotocol(const devinfo_t *d, uint16_t protocol)
+/*
+ * Adds the USB device with the given ugen name, serial number and IDs to
+ * the list, unless a device with the same ugen name is already in it. In
+ * this case, NULL is returned. serial may be NULL if it is unknown. The
+ * interfaces must be added by the caller. USB devices can be detached, so
+ * their data is allocated from the heap, and freed by remove_device().
+ */
+devinfo_t *
+add_usb_dev(devlist_t *devlist, const char *ugen, const char *serial,
+	uint16_t vendor, uint16_t product, uint16_t class, uint16_t subclass)
 {
-	int i;
+	uint32_t  h;
+	devinfo_t *dip;
 
-	for (i = 0; i < d->nifaces; i++) {
-		if (d->iface[i].protocol == protocol)
-			return (true);
+	if (find_dev(devlist, ugen) != NULL)
+		return (NULL);
+	dip = append_device(devlist, NULL);
+	dip->bus      = BUS_TYPE_USB;
+	dip->ugen     = dev_alloc(dip, strlen(ugen) + 1);
+	(void)strcpy(dip->ugen, ugen);
+	if (serial != NULL) {
+		dip->serial = dev_alloc(dip, strlen(serial) + 1);
+		(void)strcpy(dip->serial, serial);
 	}
-	return (false);
+	dip->vendor   = vendor;
+	dip->device   = product;
+	dip->class    = class;
+	dip->subclass = subclass;
+
+	h = hash_location(ugen);
+	dip->hnext = devlist->bucket[h];
+	devlist->bucket[h] = dip;
+
+	return (dip);
+}
+
+/*
+ * Adds the PCI device with the given selector (pci<domain>:<bus>:<slot>:
+ * <function>) to the list, unless it is already in it. In this case, NULL
+ * is returned. The IDs must be set by the caller.
+ */
+devinfo_t *
+add_pci_dev(devlist_t *devlist, const char *sel)
+{
+	uint32_t  h;
+	devinfo_t *dip;
+
+	if (find_dev(devlist, sel) != NULL)
+		return (NULL);
+	dip = add_device(devlist);
+	dip->bus    = BUS_TYPE_PCI;
+	dip->pcisel = dev_alloc(dip, strlen(sel) + 1);
+	(void)strcpy(dip->pcisel, sel);
+
+	h = hash_location(sel);
+	dip->hnext = devlist->bucket[h];
+	devlist->bucket[h] = dip;
+
+	return (dip);
 }
 
-static bool
-is_new(devinfo_t **devlist, uint16_t vendor, uint16_t device, uint16_t class,
-	uint16_t subclass)
+/*
+ * Adds a copy of the given device, which may be from another list, to the
+ * list, unless a device at the same location is already in it, or the
+ * device's location is unknown. In these cases, NULL is returned. The
+ * drivers and the description are not copied.
+ */
+devinfo_t *
+copy_device(devlist_t *devlist, const devinfo_t *dev)
 {
-	devinfo_t **dev;
-	
-	for (dev = devlist; dev != NULL && *dev != NULL; dev++) {
-		if ((*dev)->vendor == vendor && (*dev)->device == device &&
-		    (*dev)->class  == class && (*dev)->subclass == subclass)
-			return (false);
+	int	  i;
+	devinfo_t *dip;
+
+	if (dev_location(dev) == NULL)
+		return (NULL);
+	if (dev->bus == BUS_TYPE_USB) {
+		dip = add_usb_dev(devlist, dev->ugen, dev->serial, dev->vendor,
+		    dev->device, dev->class, dev->subclass);
+		if (dip == NULL)
+			return (NULL);
+		for (i = 0; i < dev->nifaces; i++) {
+			add_iface(dip, dev->iface[i].class,
+			    dev->iface[i].subclass, dev->iface[i].protocol);
+		}
+		return (dip);
 	}
-	return (true);
+	if ((dip = add_pci_dev(devlist, dev->pcisel)) == NULL)
+		return (NULL);
+	dip->vendor    = dev->vendor;
+	dip->subvendor = dev->subvendor;
+	dip->device    = dev->device;
+	dip->subdevice = dev->subdevice;
+	dip->class     = dev->class;
+	dip->subclass  = dev->subclass;
+	dip->revision  = dev->revision;
+
+	return (dip);
 }
 
-devinfo_t **
-get_pci_devs(devinfo_t ***devlist)
+/*
+ * Adds the PCI devices found via the PCIOCGETCONF ioctl to the list.
+ */
+static int
+devfs_get_pci_devs(devlist_t *devlist, const char *root)
 {
-	int		   i, fd, n;
-	size_t		   buflen;
-	devinfo_t	   *dip, **tail;
+	int		   fd, nadded;
+	char		   sel[32];
+	size_t		   i, n, size;
+	devinfo_t	   *dip;
 	struct pci_conf	   *conf;
 	struct pci_conf_io pc;
+	static size_t	   lastsize = PCI_CONF_BUFSIZE;
 
-	conf = NULL; buflen = MAX_PCI_DEVS; n = 0;
 	if ((fd = open(PATH_PCI, O_RDONLY, 0)) == -1)
 		die("open(%s)", PATH_PCI);
+	/*
+	 * There is no way to query the number of devices, so the buffer is
+	 * sized to hold all devices of practically every system, or as many
+	 * as last time, in a single PCIOCGETCONF call.
+	 */
+	size = lastsize;
+	if ((conf = malloc(size * sizeof(struct pci_conf))) == NULL)
+		die("malloc()");
 	(void)memset(&pc, 0, sizeof(struct pci_conf_io));
-	do {
-		conf = realloc(conf, buflen * sizeof(struct pci_conf));
-		if (conf == NULL)
-			die("realloc()");
-		pc.matches	 = conf;
-		pc.match_buf_len = buflen; buflen += MAX_PCI_DEVS;
-
+	for (n = 0;;) {
+		pc.matches	 = &conf[n];
+		pc.match_buf_len = (size - n) * sizeof(struct pci_conf);
 		if (ioctl(fd, PCIOCGETCONF, &pc) == -1)
 			die("ioctl(PCIOCGETCONF)");
 		if (pc.status == PCI_GETCONF_ERROR)
 			die("ioctl(PCIOGETCONF) failed");
-		for (i = 0; i < pc.num_matches; i++) {
-			dip = add_device(devlist);
-			dip->bus       = BUS_TYPE_PCI;
-			dip->vendor    = conf[i].pc_vendor;
-			dip->device    = conf[i].pc_device;
-			dip->subvendor = conf[i].pc_subvendor;
-			dip->subdevice = conf[i].pc_subdevice;
-			dip->revision  = conf[i].pc_revid;
-			dip->class     = conf[i].pc_class;
-			dip->subclass  = conf[i].pc_subclass;
-			dip->descr     = get_devdescr(dip);
-			if (dip->descr != NULL) {
-				if ((dip->descr = strdup(dip->descr)) == NULL)
-					die("strdup()");
-			}
-			n++;
+		if (pc.status == PCI_GETCONF_LIST_CHANGED) {
+			/* Start over */
+			(void)memset(&pc, 0, sizeof(struct pci_conf_io));
+			n = 0;
+			continue;
 		}
-	} while (pc.status == PCI_GETCONF_MORE_DEVS);
+		n += pc.num_matches;
+		if (pc.status != PCI_GETCONF_MORE_DEVS)
+			break;
+		size *= 2;
+		conf = realloc(conf, size * sizeof(struct pci_conf));
+		if (conf == NULL)
+			die("realloc()");
+	}
+	(void)close(fd);
+	lastsize = size;
+
+	for (i = nadded = 0; i < n; i++) {
+		(void)snprintf(sel, sizeof(sel), "pci%d:%d:%d:%d",
+		    conf[i].pc_sel.pc_domain, conf[i].pc_sel.pc_bus,
+		    conf[i].pc_sel.pc_dev, conf[i].pc_sel.pc_func);
+		if ((dip = add_pci_dev(devlist, sel)) == NULL)
+			continue;
+		dip->vendor    = conf[i].pc_vendor;
+		dip->device    = conf[i].pc_device;
+		dip->subvendor = conf[i].pc_subvendor;
+		dip->subdevice = conf[i].pc_subdevice;
+		dip->revision  = conf[i].pc_revid;
+		dip->class     = conf[i].pc_class;
+		dip->subclass  = conf[i].pc_subclass;
+		nadded++;
+	}
 	free(conf);
 
-	errno = 0;
-	if (n == 0)
-		return (NULL);
-	for (tail = *devlist; tail != NULL && *tail != NULL; tail++)
-		;
-	return (&tail[-n]);
+	return (nadded);
 }
 
-devinfo_t **
-get_usb_devs(devinfo_t ***devlist)
+/*
+ * Adds the USB devices found via libusb20 to the list.
+ */
+static int
+devfs_get_usb_devs(devlist_t *devlist, const char *root)
 {
 	int			i, j, n;
-	devinfo_t		*dip, **tail;
+	char			ugen[32];
+	devinfo_t		*dip;
 	struct libusb20_device	*pdev;
 	struct libusb20_config	*usbcfg;
 	struct libusb20_backend	*pbe;
@@ -224,16 +471,14 @@ get_usb_devs(devinfo_t ***devlist)
 	for (n = 0, pdev = NULL;
 	    (pdev = libusb20_be_device_foreach(pbe, pdev));) {
 		ddesc = libusb20_dev_get_device_desc(pdev);
-		/* Check if we already have an entry for this device. */
-		if (!is_new(*devlist, ddesc->idVendor, ddesc->idProduct,
-		    ddesc->bDeviceClass, ddesc->bDeviceSubClass))
+		(void)snprintf(ugen, sizeof(ugen), "ugen%d.%d",
+		    libusb20_dev_get_bus_number(pdev),
+		    libusb20_dev_get_address(pdev));
+		dip = add_usb_dev(devlist, ugen, NULL, ddesc->idVendor,
+		    ddesc->idProduct, ddesc->bDeviceClass,
+		    ddesc->bDeviceSubClass);
+		if (dip == NULL)
 			continue;
-		dip = add_device(devlist);
-		dip->bus      = BUS_TYPE_USB;
-		dip->vendor   = ddesc->idVendor;
-		dip->device   = ddesc->idProduct;
-		dip->class    = ddesc->bDeviceClass;
-		dip->subclass = ddesc->bDeviceSubClass;
 		for (i = 0; i < ddesc->bNumConfigurations; i++) {
 			usbcfg = libusb20_dev_alloc_config(pdev, i);
 			if (usbcfg == NULL && errno != ENXIO) {
@@ -252,130 +497,133 @@ get_usb_devs(devinfo_t ***devlist)
 			}
 			free(usbcfg);
 		}
-		dip->descr = get_devdescr(dip);
-		if (dip->descr != NULL) {
-			if ((dip->descr = strdup(dip->descr)) == NULL)
-				die("strdup()");
-		}
 		n++;
 	}
 	libusb20_be_free(pbe);
 
+	return (n);
+}
+
+/*
+ * Selects the enumeration backend with the given name. If root is not
+ * NULL, it replaces the backend's default root directory. Returns false if
+ * there is no such backend.
+ */
+bool
+set_dev_backend(const char *name, const char *root)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (strcmp(backends[i].name, name) == 0) {
+			backend = &backends[i];
+			backend_root = root;
+			return (true);
+		}
+	}
+	return (false);
+}
+
+devinfo_t **
+get_pci_devs(devlist_t *devlist)
+{
+	return (get_devs(devlist, backend->get_pci_devs));
+}
+
+devinfo_t **
+get_usb_devs(devlist_t *devlist)
+{
+	return (get_devs(devlist, backend->get_usb_devs));
+}
+
+/*
+ * Adds the devices found by the given backend function to the list.
+ * Returns a pointer to the first new device, or NULL if there is none.
+ */
+static devinfo_t **
+get_devs(devlist_t *devlist, int (*get)(devlist_t *, const char *))
+{
+	int n;
+
+	n = get(devlist, backend_root != NULL ? backend_root : backend->root);
 	errno = 0;
 	if (n == 0)
 		return (NULL);
-	for (tail = *devlist; tail != NULL && *tail != NULL; tail++)
-		;
-	return (&tail[-n]);
+	return (&devlist->devs[devlist->ndevs - n]);
 }
 
-devinfo_t **
+devlist_t *
 init_devlist()
 {
-	devinfo_t **devlist = NULL;
-	
-	if (get_pci_devs(&devlist) == NULL || get_usb_devs(&devlist) == NULL) {
-		if (errno != 0)
+	devlist_t *devlist;
+
+	devlist = create_devlist();
+	if (get_pci_devs(devlist) == NULL || get_usb_devs(devlist) == NULL) {
+		if (errno != 0) {
+			free_devlist(devlist);
 			return (NULL);
+		}
 	}
 	return (devlist);
 }
 
-char *
-get_devdescr(const devinfo_t *dev)
+/*
+ * Returns the description of the given device, or NULL if there is none.
+ * The description is looked up on first use, and stored in dev->descr.
+ */
+const char *
+resolve_devdescr(devinfo_t *dev)
 {
-	int	    column, matching_columns, must_match;
-	FILE	    *fp;
-	char	    *p, *descr;
-	static char infostr[_POSIX2_LINE_MAX], line[_POSIX2_LINE_MAX];
+	char *descr;
 
-	errno = 0;
-	must_match = 2;
-	if (dev->bus == BUS_TYPE_PCI) {
-		if ((fp = fopen(PATH_PCIID_DB0, "r")) == NULL &&
-		    (fp = fopen(PATH_PCIID_DB1, "r")) == NULL) {
-			logprint("Couldn't open PCI ID database");
-			return (NULL);
-		}
-	} else if ((fp = fopen(PATH_USBID_DB, "r")) == NULL) {
-		logprint("Couldn't open USB ID database");
-		return (NULL);
+	if (dev->descr_resolved)
+		return (dev->descr);
+	dev->descr_resolved = true;
+	if ((descr = get_devdescr(dev)) != NULL) {
+		set_devdescr(dev, descr);
 	}
-	matching_columns = 0; infostr[0] = '\0';
-
-	if (fseek(fp, 0, SEEK_SET) == -1) {
-		logprint("fseek()");
-		(void)fclose(fp);
-		return (NULL);
-	}
-	while (fgets(line, sizeof(line) - 1, fp) != NULL) {
-		if ((p = get_next_word_start(line)) == NULL ||
-		    *p == '#' || *p == '\n')
-			continue;
-		for (column = 1; line[column - 1] == '\t'; column++)
-			;
-		if (column <= matching_columns)
-			break;
-		if (column >= matching_columns + 2)
-			continue;
-		if (match_devdescr_column(dev, line, column)) {
-			matching_columns++;
-			if ((descr = get_next_word_start(NULL)) == NULL)
-				continue;
-			if (column > 1)
-				(void)strlcat(infostr, " ", sizeof(infostr));
-			(void)strlcat(infostr, descr, sizeof(infostr));
-		}
-	}
-	(void)fclose(fp);
-	if (matching_columns >= must_match)
-		return (infostr);
-	return (NULL);
+	return (dev->descr);
 }
 
-static bool
-match_devdescr_column(const devinfo_t *dev, char *line, int column)
+/*
+ * Closes the ID databases, so they are reopened on next use.
+ */
+void
+close_id_dbs()
 {
-	int  val1, val2;
-	char *id;
-
-	(void)strtok(line, "#\n");
-	if ((id = get_next_word_start(line)) == NULL)
-		return (false);
-	val1 = strtol(id, NULL, 16);
-	if (column == DESCR_DB_VENDOR_COLUMN) {
-		if (val1 == dev->vendor)
-			return (true);
-	} else if (column == DESCR_DB_DEVICE_COLUMN) {
-		if (val1 == dev->device)
-			return (true);
-	} else if (column == DESCR_DB_SUB_COLUMN) {
-		if ((id = get_next_word_start(NULL)) == NULL)
-			return (false);
-		val2 = strtol(id, NULL, 16);
-		if (val1 == dev->subvendor && val2 == dev->subdevice)
-			return (true);
-	}
-	return (false);
+	close_id_db(pciids);
+	close_id_db(usbids);
+	pciids = usbids = NULL;
 }
 
-static char *
-get_next_word_start(char *str)
+/*
+ * Looks up the description of the given device in the PCI or USB ID
+ * database. The databases are mapped and indexed on first use. The
+ * returned string is valid until the next call.
+ */
+char *
+get_devdescr(const devinfo_t *dev)
 {
-	static char *next = NULL;
+	static char    infostr[_POSIX2_LINE_MAX];
+	const id_db_t  *db;
 
-	if (str == NULL) {
-		/* Get start of next word. */
-		if ((str = next) == NULL)
+	errno = 0;
+	if (dev->bus == BUS_TYPE_PCI) {
+		if (pciids == NULL &&
+		    (pciids = open_id_db(PATH_PCIID_DB0)) == NULL &&
+		    (pciids = open_id_db(PATH_PCIID_DB1)) == NULL) {
+			logprint("Couldn't open PCI ID database");
 			return (NULL);
+		}
+		db = pciids;
+	} else {
+		if (usbids == NULL &&
+		    (usbids = open_id_db(PATH_USBID_DB)) == NULL) {
+			logprint("Couldn't open USB ID database");
+			return (NULL);
+		}
+		db = usbids;
 	}
-	while (isspace(*str))
-		str++;
-	if (*str == '\0')
-		str = next = NULL;
-	else {
-		for (next = str; *next != '\0' && !isspace(*next); next++)
-			;
-	}
-	return (str);
+	return (lookup_id_db(db, dev->vendor, dev->device, dev->subvendor,
+	    dev->subdevice, infostr, sizeof(infostr)));
 }
@@ -24,8 +24,11 @@
 #ifndef _DEVICE_H_
 #define _DEVICE_H_
 #include <sys/types.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+#include "arena.h"
+
 enum BUS_TYPE {	BUS_TYPE_USB = 1, BUS_TYPE_PCI };
 
 /*
@@ -41,7 +44,11 @@ typedef struct iface_s {
  * Struct to represent a device.
  */
 typedef struct devinfo_s {
-	char	*descr;
+	char	*descr;			/* Use resolve_devdescr() */
+	char	*ugen;			/* ugen name of USB devices */
+	char	*serial;		/* USB serial number, or NULL */
+	char	*pcisel;		/* PCI selector (pciD:B:S:F) */
+	bool	descr_resolved;		/* descr has been looked up */
 	char	**drivers;		/* List of associated drivers */
 	uint8_t  bus;
 	uint16_t vendor;		/* Vendor ID */
@@ -54,14 +61,57 @@ typedef struct devinfo_s {
 	uint16_t ndrivers;		/* # of drivers for this device */
 	uint16_t nifaces;		/* # of USB interfaces. */
 	iface_t *iface;			/* USB interfaces. */
+	arena_t *arena;			/* Memory of the device's data, or
+					   NULL to use malloc() */
+	struct devinfo_s *hnext;	/* Next device in hash bucket */
 } devinfo_t;
 
-extern bool	 match_ifsubclass(const devinfo_t *, uint16_t);
-extern bool	 match_ifclass(const devinfo_t *, uint16_t);
-extern bool	 match_ifprotocol(const devinfo_t *, uint16_t);
+/*
+ * NULL-terminated list of devices. The devices and their data are
+ * allocated from the list's arena, and freed all at once with the list.
+ * USB devices, which can be removed, are allocated from the heap.
+ */
+#define DEVLIST_BUCKETS 64
+
+typedef struct devlist_s {
+	devinfo_t **devs;
+	size_t	  ndevs;
+	size_t	  size;			/* # of allocated slots in devs */
+	arena_t	  *arena;
+	devinfo_t *bucket[DEVLIST_BUCKETS]; /* Devices by ugen/PCI sel. */
+} devlist_t;
+
+/*
+ * Device enumeration backend. The functions add the PCI or USB devices
+ * found below the given root directory to the list, and return their
+ * number. "devfs" uses /dev/pci and libusb20, and is the default. "sysfs"
+ * reads linsysfs, or a copy of a Linux sysfs tree. "replay" reads an
+ * inventory snapshot file given as root.
+ */
+typedef struct dev_backend_s {
+	const char *name;
+	int	   (*get_pci_devs)(devlist_t *, const char *);
+	int	   (*get_usb_devs)(devlist_t *, const char *);
+	const char *root;		/* Default root directory */
+} dev_backend_t;
+
 extern void	 add_driver(devinfo_t *, const char *);
+extern void	 add_iface(devinfo_t *, uint16_t, uint16_t, uint16_t);
+extern void	 set_devdescr(devinfo_t *, const char *);
+extern void	 close_id_dbs(void);
+extern bool	 set_dev_backend(const char *, const char *);
+extern void	 free_devlist(devlist_t *);
+extern void	 remove_device(devlist_t *, devinfo_t *);
 extern char	 *get_devdescr(const devinfo_t *);
-extern devinfo_t **init_devlist(void);
-extern devinfo_t **get_pci_devs(devinfo_t ***);
-extern devinfo_t **get_usb_devs(devinfo_t ***);
+extern const char *resolve_devdescr(devinfo_t *);
+extern devlist_t *create_devlist(void);
+extern devlist_t *init_devlist(void);
+extern devinfo_t *add_device(devlist_t *);
+extern devinfo_t *find_dev(devlist_t *, const char *);
+extern devinfo_t *copy_device(devlist_t *, const devinfo_t *);
+extern devinfo_t *add_pci_dev(devlist_t *, const char *);
+extern devinfo_t *add_usb_dev(devlist_t *, const char *, const char *,
+			uint16_t, uint16_t, uint16_t, uint16_t);
+extern devinfo_t **get_pci_devs(devlist_t *);
+extern devinfo_t **get_usb_devs(devlist_t *);
 #endif
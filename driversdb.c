@@ -0,0 +1,1028 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "device.h"
+#include "driversdb.h"
+
+#define DB_WILDCARD	 -1
+#define DB_MAX_DEPTH	 4
+#define DB_IMAGE_MAGIC	 "DSBDRVDB"
+#define DB_IMAGE_VERSION 2
+#define DB_IMAGE_BOM	 0x01020304	/* Byte order mark */
+#define DB_IMAGE_ALIGN	 8
+
+enum DB_INDEX_LIST {
+	DB_INDEX_EXACT = 0,	/* Rules with vendor and device ID */
+	DB_INDEX_VENDOR,	/* Rules with vendor ID and device wildcard */
+	DB_INDEX_WILDCARD,	/* Rules with vendor wildcard */
+	DB_INDEX_NLISTS
+};
+
+/*
+ * Bits of the fields constrained by the extra info column.
+ */
+#define DB_PRED_REVISION   (1 << 0)
+#define DB_PRED_CLASS	   (1 << 1)
+#define DB_PRED_SUBCLASS   (1 << 2)
+#define DB_PRED_IFCLASS	   (1 << 3)
+#define DB_PRED_IFSUBCLASS (1 << 4)
+#define DB_PRED_PROTOCOL   (1 << 5)
+
+enum DB_IMAGE_SECTION {
+	DB_SECT_RULES = 0,
+	DB_SECT_RECS,
+	DB_SECT_DRIVERS,
+	DB_SECT_INDEX,		/* DB_INDEX_NLISTS sections */
+	DB_SECT_STRTAB = DB_SECT_INDEX + DB_INDEX_NLISTS,
+	DB_SECT_NSECTS
+};
+
+/*
+ * The 'key=value' pairs of the extra info column, parsed at load time.
+ */
+typedef struct db_preds_s {
+	uint16_t mask;		/* DB_PRED_* bits of constrained fields */
+	uint16_t revision;
+	uint16_t class;
+	uint16_t subclass;
+	uint16_t ifclass;
+	uint16_t ifsubclass;
+	uint16_t protocol;
+	uint16_t pad;
+} db_preds_t;
+
+/*
+ * A rule represents a path from a vendor line to a leaf line of a
+ * driver record. A record matches a device if any of its rules matches.
+ */
+typedef struct db_rule_s {
+	int32_t	   vendor;	/* Vendor ID or DB_WILDCARD */
+	int32_t	   device;	/* Device ID or DB_WILDCARD */
+	int32_t	   subvendor;	/* Subvendor ID or DB_WILDCARD */
+	int32_t	   subdevice;	/* Subdevice ID or DB_WILDCARD */
+	uint32_t   rec;		/* Index of the driver record */
+	db_preds_t preds;	/* Constraints from the extra info column */
+} db_rule_t;
+
+typedef struct db_record_s {
+	uint32_t drivers;	/* Index of first driver name in drivers[] */
+	uint32_t ndrivers;	/* # of driver names */
+} db_record_t;
+
+typedef struct db_key_s {
+	uint32_t key;		/* vendor << 16 | device, vendor, or 0 */
+	uint32_t rule;		/* Index of rule */
+} db_key_t;
+
+/*
+ * Header of the compiled DB image. The sections follow the header, each
+ * aligned to DB_IMAGE_ALIGN bytes. All references between sections are
+ * indices or offsets, so the image can be mapped at any address.
+ */
+typedef struct db_image_hdr_s {
+	char	 magic[8];
+	uint32_t version;
+	uint32_t bom;
+	uint32_t size;		/* Size of the image in bytes */
+	uint32_t pad;
+	struct {
+		uint32_t offs;	/* Offset from start of image */
+		uint32_t n;	/* # of elements */
+	} sect[DB_SECT_NSECTS];
+} db_image_hdr_t;
+
+/*
+ * Tables of a DB parsed from the text file, and their capacities while
+ * parsing.
+ */
+typedef struct db_tables_s {
+	char	    *strtab;
+	size_t	    strtabsz, strtabcap;
+	uint32_t    *drivers;
+	size_t	    ndrivers, driverscap;
+	db_rule_t   *rules;
+	size_t	    nrules, rulescap;
+	db_record_t *recs;
+	size_t	    nrecs, recscap;
+	db_key_t    *index[DB_INDEX_NLISTS];
+	size_t	    nindex[DB_INDEX_NLISTS];
+} db_tables_t;
+
+/*
+ * The tables point into an image, or to the tables parsed from text.
+ */
+struct drivers_db_s {
+	const char	  *strtab;	/* Interned driver names */
+	size_t		  strtabsz;
+	const uint32_t	  *drivers;	/* strtab offsets of driver names */
+	size_t		  ndrivers;
+	const db_rule_t	  *rules;
+	size_t		  nrules;
+	const db_record_t *recs;
+	size_t		  nrecs;
+	const db_key_t	  *index[DB_INDEX_NLISTS];
+	size_t		  nindex[DB_INDEX_NLISTS];
+	db_tables_t	  *tables;	/* Tables parsed from text, or NULL */
+	void		  *mapping;	/* Image mapped by map_drivers_db() */
+	size_t		  mappingsz;
+	drivers_db_t	  *base;	/* DB overlaid by this one, or NULL */
+};
+
+#ifndef NO_BUILTIN_DB
+/*
+ * Tables of drivers.db as builtin_db, generated at build time by
+ * write_drivers_db_source().
+ */
+# include "driversdb_builtin.h"
+#endif
+
+static const struct pred_key_s {
+	const char *name;
+	uint16_t   bit;
+	size_t	   offs;	/* Offset of value in db_preds_t */
+} pred_keys[] = {
+	{ "revision",	DB_PRED_REVISION,   offsetof(db_preds_t, revision)   },
+	{ "class",	DB_PRED_CLASS,	    offsetof(db_preds_t, class)	     },
+	{ "subclass",	DB_PRED_SUBCLASS,   offsetof(db_preds_t, subclass)   },
+	{ "ifclass",	DB_PRED_IFCLASS,    offsetof(db_preds_t, ifclass)    },
+	{ "ifsubclass", DB_PRED_IFSUBCLASS, offsetof(db_preds_t, ifsubclass) },
+	{ "protocol",	DB_PRED_PROTOCOL,   offsetof(db_preds_t, protocol)   }
+};
+
+static int	keycmp(const void *, const void *);
+static bool	parse_id(const char *, char **, int32_t *);
+static bool	match_preds(const db_preds_t *, const devinfo_t *);
+static bool	match_ifclass(const devinfo_t *, uint16_t);
+static bool	match_ifsubclass(const devinfo_t *, uint16_t);
+static bool	match_ifprotocol(const devinfo_t *, uint16_t);
+static bool	match_rule(const drivers_db_t *, const db_rule_t *,
+		    const devinfo_t *);
+static bool	check_image(const drivers_db_t *);
+static void	*grow(void *, size_t *, size_t, size_t);
+static void	add_rule(db_tables_t *, const int32_t *, int,
+		    const db_preds_t *);
+static void	build_index(db_tables_t *);
+static void	find_key_range(const db_key_t *, size_t, uint32_t, size_t *,
+		    size_t *);
+static uint32_t	add_driver_name(db_tables_t *, const char *);
+static void	parse_preds(const char *, int, char *, db_preds_t *);
+static void	set_cursor_db(db_cursor_t *, const drivers_db_t *);
+static drivers_db_t *attach_image(const void *, size_t);
+
+/*
+ * Reads the drivers DB from the given path, and creates an index of its
+ * rules. Returns NULL if the file could not be opened.
+ */
+drivers_db_t *
+load_drivers_db(const char *path)
+{
+	int	     i, column, prevcol, skipcol, lineno;
+	FILE	     *fp;
+	char	     ln[_POSIX2_LINE_MAX], *lp, *p, *extra;
+	int32_t	     id, path_ids[DB_MAX_DEPTH + 1];
+	uint32_t     offs;
+	db_preds_t   path_preds;
+	db_record_t  *rec;
+	db_tables_t  *t;
+	drivers_db_t *db;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return (NULL);
+	if ((db = malloc(sizeof(drivers_db_t))) == NULL ||
+	    (t = malloc(sizeof(db_tables_t))) == NULL)
+		die("malloc()");
+	(void)memset(db, 0, sizeof(drivers_db_t));
+	(void)memset(t, 0, sizeof(db_tables_t));
+
+	/* Offset 0 is the empty string. */
+	t->strtab = grow(t->strtab, &t->strtabcap, 1, 1);
+	t->strtab[0] = '\0';
+	t->strtabsz = 1;
+
+	rec = NULL; prevcol = skipcol = 0;
+	(void)memset(&path_preds, 0, sizeof(path_preds));
+	for (lineno = 1; fgets(ln, sizeof(ln), fp) != NULL; lineno++) {
+		/* Remove '\r', '\n', and '#' */
+		lp = ln;
+		(void)strsep(&lp, "#\r\n");
+		/*
+		 * Count depth (columns/# of tabs). Ignore space characters
+		 * inbetween.
+		 */
+		for (column = 0, lp = ln; *lp != '\0'; lp++) {
+			if (*lp == '\t')
+				column++;
+			else if (*lp != ' ')
+				break;
+		}
+		/* Skip empty and whitespace-only lines */
+		if (*lp == '\0')
+			continue;
+		if (column == 0) {
+			/* Start of a new driver record */
+			if (prevcol > 0)
+				add_rule(t, path_ids, prevcol, &path_preds);
+			prevcol = skipcol = 0;
+			t->recs = grow(t->recs, &t->recscap, t->nrecs + 1,
+			    sizeof(db_record_t));
+			rec = &t->recs[t->nrecs++];
+			rec->drivers  = t->ndrivers;
+			rec->ndrivers = 0;
+			for (; (p = strsep(&lp, "\t ")) != NULL;) {
+				if (*p == '\0')
+					continue;
+				offs = add_driver_name(t, p);
+				t->drivers = grow(t->drivers, &t->driverscap,
+				    t->ndrivers + 1, sizeof(uint32_t));
+				t->drivers[t->ndrivers++] = offs;
+				rec->ndrivers++;
+			}
+			continue;
+		}
+		/* Ignore the subtree of an invalid line. */
+		if (skipcol > 0 && column > skipcol)
+			continue;
+		skipcol = 0;
+		if (rec == NULL || column > DB_MAX_DEPTH ||
+		    column > prevcol + 1 ||
+		    !parse_id(lp, &extra, &id)) {
+			logprintx("%s:%d: Invalid line ignored", path, lineno);
+			skipcol = column;
+			continue;
+		}
+		/* The previous line was a leaf. */
+		if (prevcol >= column)
+			add_rule(t, path_ids, prevcol, &path_preds);
+		path_ids[column] = id;
+		if (column == 2)
+			parse_preds(path, lineno, extra, &path_preds);
+		prevcol = column;
+	}
+	if (prevcol > 0)
+		add_rule(t, path_ids, prevcol, &path_preds);
+	(void)fclose(fp);
+	build_index(t);
+
+	db->tables   = t;
+	db->strtab   = t->strtab;
+	db->strtabsz = t->strtabsz;
+	db->drivers  = t->drivers;
+	db->ndrivers = t->ndrivers;
+	db->rules    = t->rules;
+	db->nrules   = t->nrules;
+	db->recs     = t->recs;
+	db->nrecs    = t->nrecs;
+	for (i = 0; i < DB_INDEX_NLISTS; i++) {
+		db->index[i]  = t->index[i];
+		db->nindex[i] = t->nindex[i];
+	}
+	return (db);
+}
+
+/*
+ * Maps the compiled DB image from the given path. Returns NULL if the
+ * file could not be opened or is not a valid image.
+ */
+drivers_db_t *
+map_drivers_db(const char *path)
+{
+	int	     fd;
+	void	     *image;
+	struct stat  sb;
+	drivers_db_t *db;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (NULL);
+	if (fstat(fd, &sb) == -1) {
+		(void)close(fd);
+		return (NULL);
+	}
+	if ((size_t)sb.st_size < sizeof(db_image_hdr_t)) {
+		(void)close(fd);
+		errno = EFTYPE;
+		return (NULL);
+	}
+	image = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	(void)close(fd);
+	if (image == MAP_FAILED)
+		return (NULL);
+	if ((db = attach_image(image, sb.st_size)) == NULL) {
+		(void)munmap(image, sb.st_size);
+		errno = EFTYPE;
+		return (NULL);
+	}
+	db->mapping   = image;
+	db->mappingsz = sb.st_size;
+
+	return (db);
+}
+
+/*
+ * Returns the DB compiled into the program. No file is read. Returns NULL
+ * with errno set to ENOENT if the program was built without a built-in
+ * DB.
+ */
+drivers_db_t *
+open_builtin_drivers_db()
+{
+#ifdef NO_BUILTIN_DB
+	errno = ENOENT;
+	return (NULL);
+#else
+	drivers_db_t *db;
+
+	if ((db = malloc(sizeof(drivers_db_t))) == NULL)
+		die("malloc()");
+	*db = builtin_db;
+
+	return (db);
+#endif
+}
+
+/*
+ * Writes the given DB as compiled image to path. The image is written
+ * to a temporary file first, which is then renamed to path.
+ */
+int
+write_drivers_db(const drivers_db_t *db, const char *path)
+{
+	int	       i, saved_errno;
+	FILE	       *fp;
+	char	       tmppath[PATH_MAX];
+	size_t	       offs, len;
+	const void     *data[DB_SECT_NSECTS];
+	size_t	       elsz[DB_SECT_NSECTS];
+	db_image_hdr_t hdr;
+	static const char pad[DB_IMAGE_ALIGN];
+
+	(void)memset(&hdr, 0, sizeof(hdr));
+	(void)memcpy(hdr.magic, DB_IMAGE_MAGIC, sizeof(hdr.magic));
+	hdr.version = DB_IMAGE_VERSION;
+	hdr.bom	    = DB_IMAGE_BOM;
+
+	data[DB_SECT_RULES]   = db->rules;
+	elsz[DB_SECT_RULES]   = sizeof(db_rule_t);
+	hdr.sect[DB_SECT_RULES].n = db->nrules;
+	data[DB_SECT_RECS]    = db->recs;
+	elsz[DB_SECT_RECS]    = sizeof(db_record_t);
+	hdr.sect[DB_SECT_RECS].n = db->nrecs;
+	data[DB_SECT_DRIVERS] = db->drivers;
+	elsz[DB_SECT_DRIVERS] = sizeof(uint32_t);
+	hdr.sect[DB_SECT_DRIVERS].n = db->ndrivers;
+	for (i = 0; i < DB_INDEX_NLISTS; i++) {
+		data[DB_SECT_INDEX + i] = db->index[i];
+		elsz[DB_SECT_INDEX + i] = sizeof(db_key_t);
+		hdr.sect[DB_SECT_INDEX + i].n = db->nindex[i];
+	}
+	data[DB_SECT_STRTAB]  = db->strtab;
+	elsz[DB_SECT_STRTAB]  = 1;
+	hdr.sect[DB_SECT_STRTAB].n = db->strtabsz;
+
+	for (i = 0, offs = sizeof(hdr); i < DB_SECT_NSECTS; i++) {
+		offs = roundup2(offs, DB_IMAGE_ALIGN);
+		hdr.sect[i].offs = offs;
+		offs += hdr.sect[i].n * elsz[i];
+	}
+	if (offs > UINT32_MAX) {
+		errno = EFBIG;
+		return (-1);
+	}
+	hdr.size = offs;
+
+	(void)snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if ((fp = fopen(tmppath, "w")) == NULL)
+		return (-1);
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto error;
+	for (i = 0, offs = sizeof(hdr); i < DB_SECT_NSECTS; i++) {
+		len = hdr.sect[i].offs - offs;
+		if (len > 0 && fwrite(pad, len, 1, fp) != 1)
+			goto error;
+		len = hdr.sect[i].n * elsz[i];
+		if (len > 0 && fwrite(data[i], len, 1, fp) != 1)
+			goto error;
+		offs = hdr.sect[i].offs + len;
+	}
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		goto error;
+	}
+	if (rename(tmppath, path) == -1) {
+		fp = NULL;
+		goto error;
+	}
+	return (0);
+error:
+	saved_errno = errno;
+	if (fp != NULL)
+		(void)fclose(fp);
+	(void)unlink(tmppath);
+	errno = saved_errno;
+
+	return (-1);
+}
+
+/*
+ * Writes the tables of the given DB as C source to path, which defines
+ * them as builtin_db. The tables are compiled into the program, so the
+ * source can be generated on a build host of another architecture.
+ */
+int
+write_drivers_db_source(const drivers_db_t *db, const char *path)
+{
+	int		list, saved_errno;
+	FILE		*fp;
+	char		tmppath[PATH_MAX];
+	size_t		i;
+	const db_rule_t	*r;
+
+	(void)snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if ((fp = fopen(tmppath, "w")) == NULL)
+		return (-1);
+	(void)fprintf(fp, "/* Generated from drivers.db. Do not edit. */\n");
+	/* Arrays get a terminating element, so none is empty. */
+	(void)fprintf(fp, "static const db_rule_t builtin_rules[] = {\n");
+	for (i = 0; i < db->nrules; i++) {
+		r = &db->rules[i];
+		(void)fprintf(fp, "\t{ %d, %d, %d, %d, %u, "
+		    "{ %u, %u, %u, %u, %u, %u, %u, 0 } },\n",
+		    r->vendor, r->device, r->subvendor, r->subdevice, r->rec,
+		    r->preds.mask, r->preds.revision, r->preds.class,
+		    r->preds.subclass, r->preds.ifclass, r->preds.ifsubclass,
+		    r->preds.protocol);
+	}
+	(void)fprintf(fp, "\t{ 0 }\n};\n");
+	(void)fprintf(fp, "static const db_record_t builtin_recs[] = {\n");
+	for (i = 0; i < db->nrecs; i++) {
+		(void)fprintf(fp, "\t{ %u, %u },\n", db->recs[i].drivers,
+		    db->recs[i].ndrivers);
+	}
+	(void)fprintf(fp, "\t{ 0 }\n};\n");
+	(void)fprintf(fp, "static const uint32_t builtin_drivers[] = {\n");
+	for (i = 0; i < db->ndrivers; i++)
+		(void)fprintf(fp, "\t%u,\n", db->drivers[i]);
+	(void)fprintf(fp, "\t0\n};\n");
+	for (list = 0; list < DB_INDEX_NLISTS; list++) {
+		(void)fprintf(fp, "static const db_key_t builtin_index%d[] = "
+		    "{\n", list);
+		for (i = 0; i < db->nindex[list]; i++) {
+			(void)fprintf(fp, "\t{ %u, %u },\n",
+			    db->index[list][i].key, db->index[list][i].rule);
+		}
+		(void)fprintf(fp, "\t{ 0 }\n};\n");
+	}
+	(void)fprintf(fp, "static const char builtin_strtab[] = {");
+	for (i = 0; i < db->strtabsz; i++) {
+		(void)fprintf(fp, "%s%d,", i % 16 == 0 ? "\n\t" : " ",
+		    db->strtab[i]);
+	}
+	(void)fprintf(fp, "\n};\n");
+	(void)fprintf(fp, "static const drivers_db_t builtin_db = {\n"
+	    "\t.strtab = builtin_strtab, .strtabsz = %zu,\n"
+	    "\t.drivers = builtin_drivers, .ndrivers = %zu,\n"
+	    "\t.rules = builtin_rules, .nrules = %zu,\n"
+	    "\t.recs = builtin_recs, .nrecs = %zu,\n\t.index = {",
+	    db->strtabsz, db->ndrivers, db->nrules, db->nrecs);
+	for (list = 0; list < DB_INDEX_NLISTS; list++)
+		(void)fprintf(fp, " builtin_index%d,", list);
+	(void)fprintf(fp, " },\n\t.nindex = {");
+	for (list = 0; list < DB_INDEX_NLISTS; list++)
+		(void)fprintf(fp, " %zu,", db->nindex[list]);
+	(void)fprintf(fp, " }\n};\n");
+	if (ferror(fp)) {
+		(void)fclose(fp);
+		goto error;
+	}
+	if (fclose(fp) != 0 || rename(tmppath, path) == -1)
+		goto error;
+	return (0);
+error:
+	saved_errno = errno;
+	(void)unlink(tmppath);
+	errno = saved_errno;
+
+	return (-1);
+}
+
+void
+free_drivers_db(drivers_db_t *db)
+{
+	int i;
+
+	if (db == NULL)
+		return;
+	free_drivers_db(db->base);
+	if (db->mapping != NULL)
+		(void)munmap(db->mapping, db->mappingsz);
+	if (db->tables != NULL) {
+		for (i = 0; i < DB_INDEX_NLISTS; i++)
+			free(db->tables->index[i]);
+		free(db->tables->strtab);
+		free(db->tables->drivers);
+		free(db->tables->rules);
+		free(db->tables->recs);
+		free(db->tables);
+	}
+	free(db);
+}
+
+/*
+ * Makes db overlay base. For devices matched by any record of db, only
+ * the drivers of db are used. Other devices are looked up in base. The
+ * base is freed along with db.
+ */
+void
+overlay_drivers_db(drivers_db_t *db, drivers_db_t *base)
+{
+	free_drivers_db(db->base);
+	db->base = base;
+}
+
+void
+init_db_cursor(const drivers_db_t *db, const devinfo_t *dev, db_cursor_t *cur)
+{
+	(void)memset(cur, 0, sizeof(db_cursor_t));
+	cur->dev = dev;
+	set_cursor_db(cur, db);
+}
+
+/*
+ * Makes the cursor iterate over the candidate rules of the given DB.
+ */
+static void
+set_cursor_db(db_cursor_t *cur, const drivers_db_t *db)
+{
+	const devinfo_t *dev = cur->dev;
+
+	cur->db	    = db;
+	cur->rec    = UINT32_MAX;
+	cur->drv    = cur->drvend = 0;
+	find_key_range(db->index[DB_INDEX_EXACT], db->nindex[DB_INDEX_EXACT],
+	    (uint32_t)dev->vendor << 16 | dev->device,
+	    &cur->pos[DB_INDEX_EXACT], &cur->end[DB_INDEX_EXACT]);
+	find_key_range(db->index[DB_INDEX_VENDOR], db->nindex[DB_INDEX_VENDOR],
+	    dev->vendor, &cur->pos[DB_INDEX_VENDOR],
+	    &cur->end[DB_INDEX_VENDOR]);
+	cur->pos[DB_INDEX_WILDCARD] = 0;
+	cur->end[DB_INDEX_WILDCARD] = db->nindex[DB_INDEX_WILDCARD];
+}
+
+/*
+ * Returns the next driver matching the cursor's device, or NULL if there
+ * are no more matching drivers. If the DB overlays another one, and none
+ * of its records matches the device, the drivers of the DB below are
+ * returned.
+ */
+const char *
+next_db_driver(db_cursor_t *cur)
+{
+	int		   i, list;
+	uint32_t	   r, next;
+	const db_rule_t	   *rule;
+	const drivers_db_t *db;
+
+	for (db = cur->db;;) {
+		if (cur->drv < cur->drvend)
+			return (&db->strtab[db->drivers[cur->drv++]]);
+		/* Get the candidate rule with the lowest index. */
+		for (i = 0, list = -1, next = UINT32_MAX;
+		    i < DB_INDEX_NLISTS; i++) {
+			if (cur->pos[i] >= cur->end[i])
+				continue;
+			r = db->index[i][cur->pos[i]].rule;
+			if (r < next) {
+				next = r;
+				list = i;
+			}
+		}
+		if (list == -1) {
+			if (cur->matched || db->base == NULL)
+				return (NULL);
+			set_cursor_db(cur, db = db->base);
+			continue;
+		}
+		cur->pos[list]++;
+		rule = &db->rules[next];
+		/* Rules are ordered by record, report each record once. */
+		if (rule->rec == cur->rec)
+			continue;
+		if (!match_rule(db, rule, cur->dev))
+			continue;
+		cur->matched = true;
+		cur->rec    = rule->rec;
+		cur->drv    = db->recs[rule->rec].drivers;
+		cur->drvend = cur->drv + db->recs[rule->rec].ndrivers;
+	}
+}
+
+static bool
+match_rule(const drivers_db_t *db, const db_rule_t *rule, const devinfo_t *dev)
+{
+	if (rule->vendor != DB_WILDCARD && rule->vendor != dev->vendor)
+		return (false);
+	if (rule->device != DB_WILDCARD && rule->device != dev->device)
+		return (false);
+	if (rule->subvendor != DB_WILDCARD && rule->subvendor != dev->subvendor)
+		return (false);
+	if (rule->subdevice != DB_WILDCARD && rule->subdevice != dev->subdevice)
+		return (false);
+	return (match_preds(&rule->preds, dev));
+}
+
+static bool
+match_ifclass(const devinfo_t *d, uint16_t class)
+{
+	int i;
+
+	for (i = 0; i < d->nifaces; i++) {
+		if (d->iface[i].class == class)
+			return (true);
+	}
+	return (false);
+}
+
+static bool
+match_ifsubclass(const devinfo_t *d, uint16_t subclass)
+{
+	int i;
+
+	for (i = 0; i < d->nifaces; i++) {
+		if (d->iface[i].subclass == subclass)
+			return (true);
+	}
+	return (false);
+}
+
+static bool
+match_ifprotocol(const devinfo_t *d, uint16_t protocol)
+{
+	int i;
+
+	for (i = 0; i < d->nifaces; i++) {
+		if (d->iface[i].protocol == protocol)
+			return (true);
+	}
+	return (false);
+}
+
+static bool
+match_preds(const db_preds_t *preds, const devinfo_t *dev)
+{
+	if (preds->mask == 0)
+		return (true);
+	if ((preds->mask & DB_PRED_REVISION) &&
+	    preds->revision != dev->revision)
+		return (false);
+	if ((preds->mask & DB_PRED_CLASS) && preds->class != dev->class)
+		return (false);
+	if ((preds->mask & DB_PRED_SUBCLASS) &&
+	    preds->subclass != dev->subclass)
+		return (false);
+	if ((preds->mask & DB_PRED_IFCLASS) &&
+	    !match_ifclass(dev, preds->ifclass))
+		return (false);
+	if ((preds->mask & DB_PRED_IFSUBCLASS) &&
+	    !match_ifsubclass(dev, preds->ifsubclass))
+		return (false);
+	if ((preds->mask & DB_PRED_PROTOCOL) &&
+	    !match_ifprotocol(dev, preds->protocol))
+		return (false);
+	return (true);
+}
+
+/*
+ * Parses the 'key=value' pairs of the extra info column into preds.
+ * Unknown keys and invalid values are reported, and ignored.
+ */
+static void
+parse_preds(const char *path, int lineno, char *str, db_preds_t *preds)
+{
+	long   val;
+	char   *p, *q, *end;
+	size_t i;
+
+	(void)memset(preds, 0, sizeof(db_preds_t));
+	while ((p = strsep(&str, "\t ")) != NULL) {
+		if (*p == '\0')
+			continue;
+		if ((q = strchr(p, '=')) == NULL) {
+			logprintx("%s:%d: Invalid extra info '%s'", path,
+			    lineno, p);
+			continue;
+		}
+		*q++ = '\0';
+		for (i = 0; i < sizeof(pred_keys) / sizeof(pred_keys[0]); i++) {
+			if (strcmp(p, pred_keys[i].name) == 0)
+				break;
+		}
+		if (i == sizeof(pred_keys) / sizeof(pred_keys[0])) {
+			logprintx("%s:%d: Unknown key '%s'", path, lineno, p);
+			continue;
+		}
+		val = strtol(q, &end, 16);
+		if (end == q || *end != '\0' || val < 0 || val > UINT16_MAX) {
+			logprintx("%s:%d: Invalid value '%s' for key '%s'",
+			    path, lineno, q, p);
+			continue;
+		}
+		preds->mask |= pred_keys[i].bit;
+		*(uint16_t *)((char *)preds + pred_keys[i].offs) = val;
+	}
+}
+
+/*
+ * Parses the hexadecimal ID or wildcard at the start of str. On success,
+ * *end points to the rest of the line.
+ */
+static bool
+parse_id(const char *str, char **end, int32_t *id)
+{
+	long val;
+
+	if (*str == '*') {
+		*id  = DB_WILDCARD;
+		*end = (char *)str + 1;
+		return (true);
+	}
+	val = strtol(str, end, 16);
+	if (*end == str || val < 0 || val > UINT16_MAX)
+		return (false);
+	if (**end != '\0' && **end != ' ' && **end != '\t')
+		return (false);
+	*id = (int32_t)val;
+	return (true);
+}
+
+/*
+ * Adds a rule for the path from the vendor column to the given leaf
+ * column.
+ */
+static void
+add_rule(db_tables_t *t, const int32_t *ids, int depth,
+	const db_preds_t *preds)
+{
+	db_rule_t *rule;
+
+	t->rules = grow(t->rules, &t->rulescap, t->nrules + 1,
+	    sizeof(db_rule_t));
+	rule = &t->rules[t->nrules];
+	rule->rec	= t->nrecs - 1;
+	rule->vendor	= ids[1];
+	rule->device	= depth >= 2 ? ids[2] : DB_WILDCARD;
+	rule->subvendor = depth >= 3 ? ids[3] : DB_WILDCARD;
+	rule->subdevice = depth >= 4 ? ids[4] : DB_WILDCARD;
+	if (depth >= 2)
+		rule->preds = *preds;
+	else
+		(void)memset(&rule->preds, 0, sizeof(db_preds_t));
+	t->nrules++;
+}
+
+/*
+ * Returns the strtab offset of the given driver name. Each name is
+ * stored only once.
+ */
+static uint32_t
+add_driver_name(db_tables_t *t, const char *name)
+{
+	size_t	 i, len;
+	uint32_t offs;
+
+	for (i = 0; i < t->ndrivers; i++) {
+		if (strcmp(&t->strtab[t->drivers[i]], name) == 0)
+			return (t->drivers[i]);
+	}
+	len = strlen(name) + 1;
+	t->strtab = grow(t->strtab, &t->strtabcap, t->strtabsz + len, 1);
+	offs = t->strtabsz;
+	(void)memcpy(&t->strtab[offs], name, len);
+	t->strtabsz += len;
+
+	return (offs);
+}
+
+/*
+ * Sorts the rules into the exact, vendor, and wildcard index lists.
+ */
+static void
+build_index(db_tables_t *t)
+{
+	int	  list;
+	size_t	  i, n;
+	uint32_t  key;
+	db_rule_t *rule;
+
+	for (list = 0; list < DB_INDEX_NLISTS; list++) {
+		t->index[list] = malloc(sizeof(db_key_t) * (t->nrules + 1));
+		if (t->index[list] == NULL)
+			die("malloc()");
+		t->nindex[list] = 0;
+	}
+	for (i = 0; i < t->nrules; i++) {
+		rule = &t->rules[i];
+		if (rule->vendor == DB_WILDCARD) {
+			list = DB_INDEX_WILDCARD;
+			key  = 0;
+		} else if (rule->device == DB_WILDCARD) {
+			list = DB_INDEX_VENDOR;
+			key  = rule->vendor;
+		} else {
+			list = DB_INDEX_EXACT;
+			key  = (uint32_t)rule->vendor << 16 | rule->device;
+		}
+		n = t->nindex[list]++;
+		t->index[list][n].key	= key;
+		t->index[list][n].rule = i;
+	}
+	for (list = 0; list < DB_INDEX_NLISTS; list++) {
+		qsort(t->index[list], t->nindex[list], sizeof(db_key_t),
+		    keycmp);
+	}
+}
+
+/*
+ * Sets up a DB object whose tables point into the given image. Returns
+ * NULL if the image is invalid.
+ */
+static drivers_db_t *
+attach_image(const void *image, size_t size)
+{
+	int		     i;
+	size_t		     elsz;
+	const char	     *base;
+	drivers_db_t	     *db;
+	const db_image_hdr_t *hdr;
+
+	hdr = image; base = image;
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, DB_IMAGE_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != DB_IMAGE_VERSION || hdr->bom != DB_IMAGE_BOM ||
+	    hdr->size != size)
+		return (NULL);
+	for (i = 0; i < DB_SECT_NSECTS; i++) {
+		switch (i) {
+		case DB_SECT_RULES:
+			elsz = sizeof(db_rule_t);
+			break;
+		case DB_SECT_RECS:
+			elsz = sizeof(db_record_t);
+			break;
+		case DB_SECT_DRIVERS:
+			elsz = sizeof(uint32_t);
+			break;
+		case DB_SECT_STRTAB:
+			elsz = 1;
+			break;
+		default:
+			elsz = sizeof(db_key_t);
+		}
+		if (hdr->sect[i].offs % DB_IMAGE_ALIGN != 0 ||
+		    hdr->sect[i].offs > size ||
+		    hdr->sect[i].n > (size - hdr->sect[i].offs) / elsz)
+			return (NULL);
+	}
+	if ((db = malloc(sizeof(drivers_db_t))) == NULL)
+		die("malloc()");
+	(void)memset(db, 0, sizeof(drivers_db_t));
+	db->rules    = (const db_rule_t *)(base +
+	    hdr->sect[DB_SECT_RULES].offs);
+	db->nrules   = hdr->sect[DB_SECT_RULES].n;
+	db->recs     = (const db_record_t *)(base +
+	    hdr->sect[DB_SECT_RECS].offs);
+	db->nrecs    = hdr->sect[DB_SECT_RECS].n;
+	db->drivers  = (const uint32_t *)(base +
+	    hdr->sect[DB_SECT_DRIVERS].offs);
+	db->ndrivers = hdr->sect[DB_SECT_DRIVERS].n;
+	db->strtab   = base + hdr->sect[DB_SECT_STRTAB].offs;
+	db->strtabsz = hdr->sect[DB_SECT_STRTAB].n;
+	for (i = 0; i < DB_INDEX_NLISTS; i++) {
+		db->index[i] = (const db_key_t *)(base +
+		    hdr->sect[DB_SECT_INDEX + i].offs);
+		db->nindex[i] = hdr->sect[DB_SECT_INDEX + i].n;
+	}
+	if (!check_image(db)) {
+		free(db);
+		return (NULL);
+	}
+	return (db);
+}
+
+/*
+ * Checks that all indices and offsets in the image are within bounds,
+ * so a corrupt image can't make lookups read outside of the mapping.
+ */
+static bool
+check_image(const drivers_db_t *db)
+{
+	int    list;
+	size_t i;
+
+	if (db->strtabsz == 0 || db->strtab[db->strtabsz - 1] != '\0')
+		return (false);
+	for (i = 0; i < db->ndrivers; i++) {
+		if (db->drivers[i] >= db->strtabsz)
+			return (false);
+	}
+	for (i = 0; i < db->nrecs; i++) {
+		if (db->recs[i].drivers > db->ndrivers ||
+		    db->recs[i].ndrivers > db->ndrivers - db->recs[i].drivers)
+			return (false);
+	}
+	for (i = 0; i < db->nrules; i++) {
+		if (db->rules[i].rec >= db->nrecs)
+			return (false);
+	}
+	for (list = 0; list < DB_INDEX_NLISTS; list++) {
+		for (i = 0; i < db->nindex[list]; i++) {
+			if (db->index[list][i].rule >= db->nrules)
+				return (false);
+		}
+	}
+	return (true);
+}
+
+/*
+ * Finds the range [*start, *end) of entries with the given key in the
+ * sorted index list.
+ */
+static void
+find_key_range(const db_key_t *list, size_t n, uint32_t key, size_t *start,
+	size_t *end)
+{
+	size_t lo, hi, mid;
+
+	for (lo = 0, hi = n; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (list[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*start = lo;
+	for (hi = lo; hi < n && list[hi].key == key; hi++)
+		;
+	*end = hi;
+}
+
+static int
+keycmp(const void *a, const void *b)
+{
+	const db_key_t *k1 = a, *k2 = b;
+
+	if (k1->key != k2->key)
+		return (k1->key < k2->key ? -1 : 1);
+	if (k1->rule != k2->rule)
+		return (k1->rule < k2->rule ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Makes sure buf has room for at least n elements of the given size.
+ */
+static void *
+grow(void *buf, size_t *cap, size_t n, size_t elsz)
+{
+	if (n <= *cap)
+		return (buf);
+	*cap = *cap == 0 ? 64 : *cap;
+	while (*cap < n)
+		*cap *= 2;
+	if ((buf = realloc(buf, *cap * elsz)) == NULL)
+		die("realloc()");
+	return (buf);
+}
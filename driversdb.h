@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DRIVERSDB_H_
+#define _DRIVERSDB_H_
+#include <sys/types.h>
+#include <stdbool.h>
+
+#include "device.h"
+
+typedef struct drivers_db_s drivers_db_t;
+
+/*
+ * Cursor to iterate over the drivers matching a device. The candidate
+ * rules come from three sorted index lists which are merged in rule
+ * order, so drivers are returned in the order they appear in the DB.
+ */
+typedef struct db_cursor_s {
+	const devinfo_t	   *dev;
+	const drivers_db_t *db;		/* DB the rules are taken from */
+	bool		   matched;	/* A record of the DB matched */
+	size_t		   pos[3];	/* Current position in index lists */
+	size_t		   end[3];	/* End of candidate range in lists */
+	uint32_t	   rec;		/* Last matching record */
+	uint32_t	   drv;		/* Next driver of matching record */
+	uint32_t	   drvend;	/* End of record's driver list */
+} db_cursor_t;
+
+extern int	    write_drivers_db(const drivers_db_t *, const char *);
+extern int	    write_drivers_db_source(const drivers_db_t *, const char *);
+extern void	    free_drivers_db(drivers_db_t *);
+extern void	    init_db_cursor(const drivers_db_t *, const devinfo_t *,
+			db_cursor_t *);
+extern void	    overlay_drivers_db(drivers_db_t *, drivers_db_t *);
+extern const char   *next_db_driver(db_cursor_t *);
+extern drivers_db_t *load_drivers_db(const char *);
+extern drivers_db_t *map_drivers_db(const char *);
+extern drivers_db_t *open_builtin_drivers_db(void);
+#endif
@@ -34,51 +34,94 @@
 #include <err.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/param.h>
 #include <sys/module.h>
 #include <sys/linker.h>
+#include <signal.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "log.h"
+#include "cache.h"
 #include "device.h"
 #include "config.h"
+#include "devdreader.h"
+#include "eventloop.h"
+#include "filewatch.h"
 #include "hints.h"
+#include "driversdb.h"
+#include "match.h"
+#include "msgqueue.h"
 
 #ifdef TEST
 # include <atf-c.h>
 #endif
 
 #define MAX_EXCLUDES	 256
+#define MAX_DRIVERS	 8		/* Max. # of drivers listed per device */
 #define PATH_DEVD_SOCKET "/var/run/devd.seqpacket.pipe"
-
-enum SOCK_ERR {
-	SOCK_ERR_CONN_CLOSED = 1,
-	SOCK_ERR_IO_ERROR
-};
-
-enum DB_COLUMNS {
-	DB_VENDOR_COLUMN = 1,
-	DB_DEVICE_COLUMN,
-	DB_SUBVENDOR_COLUMN,
-	DB_SUBDEVICE_COLUMN
-};
+#define WATCH_DELAY	 2		/* Seconds to wait for more changes */
+#define TIMER_REBUILD	 1		/* Timer ID of the index rebuild */
+#define TIMER_ATTACH	 2		/* Timer ID of the attach processing */
+#define ATTACH_WAIT	 50		/* ms to wait for more ATTACH events */
+#define ATTACH_WAIT_MAX	 500		/* Max. ms to delay attached devices */
+#define DEVD_QUEUE_SIZE	 4096		/* # of devd messages to queue */
+#define DEVD_RETRY_MIN	 100		/* First reconnect delay in ms */
+#define DEVD_RETRY_MAX	 5000		/* Max. reconnect delay in ms */
+#define DEVD_RETRY_TIME	 60		/* Seconds to try to reconnect */
 
 struct devd_event_s {
 	int  system;
 #define DEVD_SYSTEM_IFNET 1
 #define DEVD_SYSTEM_USB	  2
+#define DEVD_SYSTEM_PCI	  3
 	int  type;
 #define DEVD_TYPE_ATTACH  1
+#define DEVD_TYPE_DETACH  2
 	char *cdev;
+	char *ugen;
+	char *mode;
+	char *sernum;
+	char *dbsf;			/* PCI selector */
 	char *subsystem;
+	int  vendor;			/* -1 if not set */
+	int  product;			/* USB product or PCI device ID */
+	int  subvendor;
+	int  subdevice;
+	int  pciclass;			/* PCI class/subclass/progif */
+	int  devclass;
+	int  devsubclass;
+	int  intclass;
+	int  intsubclass;
+	int  intprotocol;
 } devdevent;
 
 static bool	 dryrun;		/* Do not load any drivers if true. */
-static FILE	 *driversdb;		/* File pointer for drivers database. */
+static bool	 replay;		/* Use the stub module loader if true */
+static bool	 verbose;		/* Log device descriptions if true */
+static char	 **stubkmods;		/* Modules "loaded" by the stub. */
+static size_t	 nstubkmods;
+static size_t	 nprocessed;		/* # of processed devices in devlist */
+static unsigned int attach_wait = ATTACH_WAIT;
+static unsigned int attach_wait_max = ATTACH_WAIT_MAX;
+static bool	 attach_scheduled;	/* Attached devices wait for timer */
+static struct timespec attach_start;	/* Time of the first pending event */
+static drivers_db_t *driversdb;	/* Index of the drivers database. */
+static pnp_index_t *pnpindex;		/* Index of the linker.hints files. */
 static char	 *exclude[MAX_EXCLUDES];/* List of drivers to exclude. */
 static config_t  *cfg;
-static devinfo_t **devlist;		/* List of devices. */
+static devlist_t *devlist;		/* List of devices. */
+static dev_cache_t *devcache;		/* Cached matches and descriptions */
+static file_watch_t *filewatch;		/* Watches the files of the indexes */
+static event_loop_t *evloop;
+static devd_reader_t *devdreader;	/* Reads the devd socket */
+static msg_queue_t *devdqueue;		/* devd messages from reader thread */
+static _Atomic int64_t lost_since;	/* When devd events were lost (ns) */
 static struct pidfh *pfh;		/* PID file handle. */
 
 static int  uconnect(const char *);
@@ -87,43 +130,84 @@ static int  parse_devd_event(char *);
 static bool has_driver(uint16_t, uint16_t);
 static bool is_excluded(const char *);
 static bool is_kmod_loaded(const char *);
-static bool match_drivers_db_column(const devinfo_t *, char *, int);
-static bool match_device_column(const devinfo_t *, char *);
 static bool match_kmod_name(const char *, const char *);
+static bool is_pending(const devinfo_t *, size_t);
+static bool is_same_dev(const devinfo_t *, const devinfo_t *);
 static void create_exclude_list(char *);
+static void compile_drivers_db(const char *, const char *);
 static void devd_reconnect(int *);
 static void process_devs(devinfo_t **);
+static void add_usb_event_dev(size_t *);
+static void remove_usb_event_dev(size_t *);
+static void remove_dev(devinfo_t *, size_t *);
+static void requeue_dev(devinfo_t *, size_t *);
+static void request_resync(int64_t);
+static void resync_devs(int64_t);
+static void add_pci_event_dev(void);
+static void remove_pci_event_dev(size_t *);
 static void call_on_add_device(devinfo_t *);
+static void call_on_remove_device(devinfo_t *);
 static void show_drivers(uint16_t, uint16_t);
 static void lockpidfile(void);
-static void print_devinfo(const devinfo_t *dev);
-static void print_pci_devinfo(const devinfo_t *, const char *);
-static void print_usb_devinfo(const devinfo_t *, const char *);
+static void print_devinfo(devinfo_t *);
+static void print_pci_devinfo(devinfo_t *, const char *);
+static void print_usb_devinfo(devinfo_t *, const char *);
+static void print_inventory(FILE *, devinfo_t *);
 static void load_driver(devinfo_t *);
 static void open_drivers_db(void);
+static void open_cache(void);
+static void open_watch(void);
+static void reload_indexes(void);
 static void daemonize(void);
 static void initcfg(void);
 static void usage(void);
-static char *read_devd_event(int, int *);
-static char *find_driver_db(const devinfo_t *);
-static char *find_driver(const devinfo_t *);
+static void read_devd_events(void *);
+static void handle_devd_event(void);
+static void *read_devd_socket(void *);
+static void queue_devd_msg(const char *);
+static void log_queue_stats(void *);
+static void read_file_events(void *);
+static void rebuild_indexes(void *);
+static void schedule_attach(void);
+static void process_attached(void *);
+static void terminate(void *);
+static void replay_snapshot(const char *);
+static int  load_kmod(const char *);
+static unsigned int attach_delay(const struct timespec *);
+static const char *devdescr(devinfo_t *);
+static const char *devlabel(devinfo_t *);
+static size_t create_driver_list(const devinfo_t *, char **, size_t);
+static size_t get_index_files(const char **, size_t);
+static int64_t monotonic_ns(void);
+static drivers_db_t *find_drivers_db(void);
 
 #ifndef TEST
 int
 main(int argc, char *argv[])
 {
-	int	 ch, error, i, devd_sock;
-	char	 *ln, *p;
-	bool	 cflag, fflag, lflag;
-	fd_set	 rset;
+	int	 ch, i, devd_sock;
+	sigset_t sigmask, osigmask;
+	pthread_t reader;
+	char	 *p, *dbsrc, *snapshot;
+	bool	 Cflag, cflag, fflag, iflag, lflag;
 	uint16_t vendor, device;
-	devinfo_t **new_devs, **dev;
+	devinfo_t **dev;
 
 	exclude[0] = NULL;
 
-	cflag = fflag = dryrun = lflag = false;
-	while ((ch = getopt(argc, argv, "c:flnhx:")) != -1) {
+	Cflag = cflag = fflag = dryrun = iflag = lflag = verbose = false;
+	while ((ch = getopt(argc, argv, "b:C:c:filnhr:vx:")) != -1) {
 		switch (ch) {
+		case 'b':
+			if ((p = strchr(optarg, ':')) != NULL)
+				*p++ = '\0';
+			if (!set_dev_backend(optarg, p))
+				diex("Unknown backend '%s'", optarg);
+			break;
+		case 'C':
+			Cflag = true;
+			dbsrc = optarg;
+			break;
 		case 'c':
 			cflag = true;
 			for (i = 0, p = optarg; (p = strtok(p, ":")) != NULL;
@@ -139,12 +223,22 @@ main(int argc, char *argv[])
 		case 'f':
 			fflag = true;
 			break;
+		case 'i':
+			iflag = lflag = true;
+			break;
 		case 'l':
 			lflag = true;
 			break;
 		case 'n':
 			dryrun = true;
 			break;
+		case 'r':
+			replay = true;
+			snapshot = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
 		case 'x':
 			create_exclude_list(optarg);
 			break;
@@ -153,11 +247,22 @@ main(int argc, char *argv[])
 			usage();
 		}
 	}
+	if (Cflag) {
+		if (optind != argc - 1)
+			usage();
+		compile_drivers_db(dbsrc, argv[optind]);
+		return (EXIT_SUCCESS);
+	}
+	if (replay) {
+		replay_snapshot(snapshot);
+		return (EXIT_SUCCESS);
+	}
 	if (!cflag && !lflag)
 		lockpidfile();
 	if (!cflag && !lflag && !fflag)
 		daemonize();
 	open_drivers_db();
+	pnpindex = load_pnp_index();
 
 	if (cflag) {
 		if (has_driver(vendor, device)) {
@@ -166,66 +271,371 @@ main(int argc, char *argv[])
 		}
 		return (EXIT_FAILURE);
 	}
-	devlist = init_devlist();
+	if ((devlist = init_devlist()) == NULL)
+		die("init_devlist()");
 
 	if (lflag) {
-		for (dev = devlist; dev != NULL && *dev != NULL; dev++)
-			print_devinfo(*dev);
+		match_devlist(driversdb, pnpindex, devlist->devs);
+		for (dev = devlist->devs; *dev != NULL; dev++) {
+			if (iflag)
+				print_inventory(stdout, *dev);
+			else
+				print_devinfo(*dev);
+		}
 		return (EXIT_SUCCESS);
 	}
 	if ((devd_sock = devd_connect()) == -1)
 		die("Couldn't connect to %s", PATH_DEVD_SOCKET);
+	if ((devdreader = open_devd_reader(devd_sock)) == NULL)
+		die("open_devd_reader()");
+	if ((devdqueue = create_msg_queue(DEVD_QUEUE_SIZE)) == NULL)
+		die("create_msg_queue()");
+	/*
+	 * Drain the devd socket while the devices are processed, which can
+	 * take long. The queue is consumed once the event loop runs. The
+	 * thread blocks all signals, so they go to the main thread.
+	 */
+	(void)sigfillset(&sigmask);
+	(void)pthread_sigmask(SIG_BLOCK, &sigmask, &osigmask);
+	if ((errno = pthread_create(&reader, NULL, read_devd_socket,
+	    &devd_sock)) != 0)
+		die("pthread_create()");
+	(void)pthread_sigmask(SIG_SETMASK, &osigmask, NULL);
 	initcfg();
+	open_cache();
+	open_watch();
+
+	process_devs(devlist->devs);
+	nprocessed = devlist->ndevs;
+
+	if ((evloop = create_event_loop()) == NULL)
+		die("create_event_loop()");
+	if (watch_fd(evloop, msg_queue_fd(devdqueue), read_devd_events,
+	    NULL) == -1)
+		die("watch_fd()");
+	if (filewatch != NULL && watch_fd(evloop, file_watch_fd(filewatch),
+	    read_file_events, NULL) == -1)
+		die("watch_fd()");
+	if (watch_signal(evloop, SIGTERM, terminate, NULL) == -1 ||
+	    watch_signal(evloop, SIGINT, terminate, NULL) == -1 ||
+	    watch_signal(evloop, SIGUSR1, log_queue_stats, NULL) == -1)
+		die("watch_signal()");
+	for (;;)
+		dispatch_events(evloop);
+	/* NOTREACHED */
+	return (EXIT_SUCCESS);
+}
+#else
+# include "test.h"
+#endif
 
-	process_devs(devlist);
+/*
+ * Processes the devd events queued by the reader thread, and schedules
+ * the processing of the devices they attached.
+ */
+static void
+read_devd_events(void *unused)
+{
+	char	*ln;
+	int64_t since;
+
+	ack_msg_queue(devdqueue);
+	while ((ln = pop_msg(devdqueue)) != NULL) {
+		if (parse_devd_event(ln) == 0)
+			handle_devd_event();
+		free(ln);
+	}
+	if ((since = atomic_exchange(&lost_since, 0)) != 0)
+		resync_devs(since);
+	else if (devlist->ndevs > nprocessed)
+		schedule_attach();
+}
+
+/*
+ * Updates the device list according to the last parsed devd event.
+ */
+static void
+handle_devd_event()
+{
+	if (devdevent.system == DEVD_SYSTEM_USB) {
+		if (devdevent.type == DEVD_TYPE_ATTACH)
+			add_usb_event_dev(&nprocessed);
+		else if (devdevent.type == DEVD_TYPE_DETACH)
+			remove_usb_event_dev(&nprocessed);
+	} else if (devdevent.system == DEVD_SYSTEM_PCI) {
+		if (devdevent.type == DEVD_TYPE_ATTACH)
+			add_pci_event_dev();
+		else if (devdevent.type == DEVD_TYPE_DETACH)
+			remove_pci_event_dev(&nprocessed);
+	}
+}
+
+/*
+ * Reader thread which does nothing but drain the devd socket into the
+ * queue, so devd doesn't drop us while devices are processed. arg points
+ * to the devd socket, which is replaced on reconnect.
+ */
+static void *
+read_devd_socket(void *arg)
+{
+	int	      n, *sock = arg;
+	char	      *ln;
+	int64_t	      since;
+	struct pollfd pfd;
 
 	for (;;) {
-		FD_ZERO(&rset); FD_SET(devd_sock, &rset);
-		while (select(devd_sock + 1, &rset, NULL, NULL, NULL) == -1) {
+		pfd.fd = *sock;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) == -1) {
 			if (errno == EINTR)
 				continue;
-			die("select()");
+			die("poll()");
 		}
-		if (!FD_ISSET(devd_sock, &rset))
-			continue;
-		while ((ln = read_devd_event(devd_sock, &error)) != NULL) {
-			if (parse_devd_event(ln) == -1)
-				continue;
-			if (devdevent.type != DEVD_TYPE_ATTACH)
-				continue;
-			if (devdevent.system == DEVD_SYSTEM_USB) {
-				new_devs = get_usb_devs(&devlist);
-				process_devs(new_devs);
-			}
+		while ((n = read_devd_msgs(devdreader)) > 0) {
+			while ((ln = next_devd_msg(devdreader, NULL)) != NULL)
+				queue_devd_msg(ln);
+			wake_msg_queue(devdqueue);
 		}
-		if (error == SOCK_ERR_CONN_CLOSED)
-			devd_reconnect(&devd_sock);
-		else if (error == SOCK_ERR_IO_ERROR)
-			die("read_devd_event()");
+		if (devd_msgs_lost(devdreader))
+			request_resync(monotonic_ns());
+		if (n == -1 && errno == ECONNRESET) {
+			since = monotonic_ns();
+			free_devd_reader(devdreader);
+			devd_reconnect(sock);
+			if ((devdreader = open_devd_reader(*sock)) == NULL)
+				die("open_devd_reader()");
+			request_resync(since);
+		} else if (n == -1)
+			die("read_devd_msgs()");
 	}
 	/* NOTREACHED */
-	return (EXIT_SUCCESS);
+	return (NULL);
+}
+
+/*
+ * Appends a copy of the given devd message to the queue. If the queue is
+ * full, blocks until the main thread caught up.
+ */
+static void
+queue_devd_msg(const char *ln)
+{
+	char *msg;
+
+	if ((msg = strdup(ln)) == NULL)
+		die("strdup()");
+	if (push_msg(devdqueue, msg))
+		return;
+	logprintx("devd queue full");
+	push_msg_wait(devdqueue, msg);
+}
+
+/*
+ * Makes the main thread resynchronize the device list after devd events
+ * were lost. since is the time the loss was detected. If a resync is
+ * already pending, the earlier time is kept.
+ */
+static void
+request_resync(int64_t since)
+{
+	int64_t pending = 0;
+
+	(void)atomic_compare_exchange_strong(&lost_since, &pending, since);
+	wake_msg_queue(devdqueue);
+}
+
+/*
+ * Re-enumerates the devices, removes the devices from the device list
+ * which are gone, and processes the ones which are new. since is the
+ * time devd events were lost, and is used to log the time to resync.
+ */
+static void
+resync_devs(int64_t since)
+{
+	size_t	   i, nadded, nremoved;
+	devlist_t  *cur;
+	devinfo_t  *dev, *curdev;
+	const char *location;
+
+	if ((cur = init_devlist()) == NULL) {
+		logprint("Resync failed");
+		return;
+	}
+	for (i = nremoved = 0; i < devlist->ndevs;) {
+		dev = devlist->devs[i];
+		location = dev->bus == BUS_TYPE_USB ? dev->ugen : dev->pcisel;
+		if (location == NULL || ((curdev = find_dev(cur, location)) !=
+		    NULL && is_same_dev(dev, curdev))) {
+			i++;
+			continue;
+		}
+		remove_dev(dev, &nprocessed);
+		nremoved++;
+	}
+	for (i = nadded = 0; i < cur->ndevs; i++) {
+		if (copy_device(devlist, cur->devs[i]) != NULL)
+			nadded++;
+	}
+	free_devlist(cur);
+	cancel_timer(evloop, TIMER_ATTACH);
+	process_attached(NULL);
+	logprintx("Resynchronized in %.3f ms: %zu devices added, %zu removed",
+	    (monotonic_ns() - since) / 1000000.0, nadded, nremoved);
+}
+
+/*
+ * Returns true if the given devices have the same IDs, and serial numbers,
+ * if known.
+ */
+static bool
+is_same_dev(const devinfo_t *a, const devinfo_t *b)
+{
+	if (a->vendor != b->vendor || a->device != b->device)
+		return (false);
+	return (a->serial == NULL || b->serial == NULL ||
+	    strcmp(a->serial, b->serial) == 0);
+}
+
+static int64_t
+monotonic_ns()
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+static void
+log_queue_stats(void *unused)
+{
+	logprintx("devd queue: %zu messages, high-water mark %zu of %zu",
+	    msg_queue_depth(devdqueue), msg_queue_hwm(devdqueue),
+	    msg_queue_size(devdqueue));
+}
+
+static void
+read_file_events(void *unused)
+{
+	/* Wait until the files stopped changing. */
+	if (read_file_watch(filewatch) && set_timer(evloop, TIMER_REBUILD,
+	    WATCH_DELAY * 1000, false, rebuild_indexes, NULL) == -1)
+		die("set_timer()");
+}
+
+static void
+rebuild_indexes(void *unused)
+{
+	reload_indexes();
+}
+
+/*
+ * Devices attached by devd events are processed after no more events
+ * arrived for attach_wait ms, so the INTERFACE events following a DEVICE
+ * event, and the events of a whole burst (e.g., from a hub) are handled
+ * at once. The delay since the first pending event is limited to
+ * attach_wait_max ms.
+ */
+static void
+schedule_attach()
+{
+	struct timespec now;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	if (set_timer(evloop, TIMER_ATTACH, attach_delay(&now), false,
+	    process_attached, NULL) == -1)
+		die("set_timer()");
+}
+
+/*
+ * Returns the ms to wait at the given time before the attached devices
+ * are processed. See schedule_attach().
+ */
+static unsigned int
+attach_delay(const struct timespec *now)
+{
+	unsigned int elapsed;
+
+	if (!attach_scheduled) {
+		attach_start = *now;
+		attach_scheduled = true;
+	}
+	elapsed = (now->tv_sec - attach_start.tv_sec) * 1000 +
+	    (now->tv_nsec - attach_start.tv_nsec) / 1000000;
+	if (elapsed >= attach_wait_max)
+		return (0);
+	return (MIN(attach_wait, attach_wait_max - elapsed));
+}
+
+static void
+process_attached(void *unused)
+{
+	attach_scheduled = false;
+	if (devlist->ndevs > nprocessed) {
+		process_devs(&devlist->devs[nprocessed]);
+		nprocessed = devlist->ndevs;
+	}
+}
+
+static void
+terminate(void *unused)
+{
+	if (devdqueue != NULL)
+		log_queue_stats(NULL);
+	logprintx("%s terminated", PROGRAM);
+	if (pfh != NULL)
+		(void)pidfile_remove(pfh);
+	exit(EXIT_SUCCESS);
 }
-#else
-# include "test.h"
-#endif
 
 static void
 usage()
 {
 	(void)printf("Usage: %s [-h]\n" \
-	       "       %s [-l | -c vendor:device] | [-fn][-x driver,...]\n",
-	       PROGRAM, PROGRAM);
+	       "       %s [-b backend[:root]][-i | -l | -c vendor:device] | " \
+	       "[-fnv][-x driver,...]\n" \
+	       "       %s -r snapshot\n" \
+	       "       %s -C drivers.db image\n",
+	       PROGRAM, PROGRAM, PROGRAM, PROGRAM);
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * Looks up the given devices in the cache, matches the remaining ones,
+ * and loads their drivers. The PNP index is reloaded first if any of the
+ * linker.hints files changed. Afterwards, the cache is updated with the
+ * results.
+ */
 static void
 process_devs(devinfo_t **devs)
 {
-	while (devs != NULL && *devs != NULL) {
-		call_on_add_device(*devs);
-		load_driver(*devs++);
+	size_t	  n, nmisses;
+	devinfo_t **dev, **misses;
+
+	for (n = 0; devs != NULL && devs[n] != NULL; n++)
+		;
+	if ((misses = malloc((n + 1) * sizeof(devinfo_t *))) == NULL)
+		die("malloc()");
+	for (dev = devs, nmisses = 0; dev != NULL && *dev != NULL; dev++) {
+		if (devcache == NULL || !lookup_dev_cache(devcache, *dev))
+			misses[nmisses++] = *dev;
+	}
+	misses[nmisses] = NULL;
+	if (nmisses > 0 && is_pnp_index_stale(pnpindex)) {
+		free_pnp_index(pnpindex);
+		pnpindex = load_pnp_index();
+	}
+	match_devlist(driversdb, pnpindex, misses);
+	free(misses);
+
+	for (dev = devs; dev != NULL && *dev != NULL; dev++) {
+		call_on_add_device(*dev);
+		load_driver(*dev);
 	}
+	if (devcache == NULL || dryrun)
+		return;
+	for (dev = devs; dev != NULL && *dev != NULL; dev++)
+		update_dev_cache(devcache, *dev);
+	if (write_dev_cache(devcache) == -1)
+		logprint("write_dev_cache(%s)", PATH_CACHE);
 }
 
 static void
@@ -264,38 +674,44 @@ daemonize()
 	(void)pidfile_write(pfh);
 }
 
-static char **
-create_driver_list(const devinfo_t *dp, size_t *len)
+/*
+ * Fills the given list with up to maxlen unique drivers for the device,
+ * and returns the number of drivers. The caller must free the list
+ * elements.
+ */
+static size_t
+create_driver_list(const devinfo_t *dev, char **list, size_t maxlen)
 {
 	size_t	    ndrivers, i;
 	const char  *p;
-	static char *list[8];
+	match_ctx_t ctx;
 
-	*len = ndrivers = 0;
-	for (; (p = find_driver(dp)) != NULL; dp = NULL) {
+	ndrivers = 0;
+	begin_match(&ctx, driversdb, pnpindex, dev);
+	while ((p = next_match(&ctx)) != NULL) {
 		for (i = 0; i < ndrivers; i++) {
 			if (strcmp(list[i], p) == 0)
 				break;
 		}
-		if (i == ndrivers) {
-			if (ndrivers >= sizeof(list) / sizeof(list[0])) {
-				logprintx("# of drivers for device %04x:%04x" \
-				    "exceeds limit", dp->vendor, dp->device);
-				return (list);
-			}
-			list[ndrivers] = strdup(p);
-			if (list[ndrivers] == NULL)
-				die("strdup()");
-			*len = ++ndrivers;
+		if (i < ndrivers)
+			continue;
+		if (ndrivers >= maxlen) {
+			logprintx("# of drivers for device %04x:%04x " \
+			    "exceeds limit", dev->vendor, dev->device);
+			break;
 		}
+		if ((list[ndrivers++] = strdup(p)) == NULL)
+			die("strdup()");
 	}
-	return (list);
+	end_match(&ctx);
+
+	return (ndrivers);
 }
 
 static void
 show_drivers(uint16_t vendor, uint16_t device)
 {
-	char	  *info, **driver_list;
+	char	  *info, *driver_list[MAX_DRIVERS];
 	size_t	  ndrivers, i;
 	devinfo_t dev;
 
@@ -308,7 +724,12 @@ show_drivers(uint16_t vendor, uint16_t device)
 		dev.bus = BUS_TYPE_USB;
 		info = get_devdescr(&dev);
 	}
-	driver_list = create_driver_list(&dev, &ndrivers);
+	if ((ndrivers = create_driver_list(&dev, driver_list,
+	    MAX_DRIVERS)) == 0) {
+		/* PNP matching depends on the bus, so try the other one. */
+		dev.bus = dev.bus == BUS_TYPE_PCI ? BUS_TYPE_USB : BUS_TYPE_PCI;
+		ndrivers = create_driver_list(&dev, driver_list, MAX_DRIVERS);
+	}
 	for (i = 0; i < ndrivers; i++) {
 		(void)printf("%s: %s\n", info != NULL ? info: "", driver_list[i]);
 		free(driver_list[i]);
@@ -318,13 +739,22 @@ show_drivers(uint16_t vendor, uint16_t device)
 static bool
 has_driver(uint16_t vendor, uint16_t device)
 {
-	devinfo_t dev;
+	bool	    found;
+	devinfo_t   dev;
+	match_ctx_t ctx;
 
 	(void)memset(&dev, 0, sizeof(dev));
 	dev.vendor = vendor;
 	dev.device = device;
 
-	return (find_driver(&dev) != NULL ? true : false);
+	/* The ID could belong to a PCI or USB device. */
+	for (found = false, dev.bus = BUS_TYPE_USB;
+	    !found && dev.bus <= BUS_TYPE_PCI; dev.bus++) {
+		begin_match(&ctx, driversdb, pnpindex, &dev);
+		found = next_match(&ctx) != NULL;
+		end_match(&ctx);
+	}
+	return (found);
 }
 
 static void
@@ -334,6 +764,56 @@ call_on_add_device(devinfo_t *dev)
 		call_cfg_function(cfg, "on_add_device", dev, NULL);
 }
 
+static void
+call_on_remove_device(devinfo_t *dev)
+{
+	if (cfg != NULL && !dryrun)
+		call_cfg_function(cfg, "on_remove_device", dev, NULL);
+}
+
+/*
+ * Loads the given kernel module, or just remembers it as loaded if the
+ * stub loader is used.
+ */
+static int
+load_kmod(const char *name)
+{
+	if (!replay)
+		return (kldload(name));
+	stubkmods = realloc(stubkmods, (nstubkmods + 1) * sizeof(char *));
+	if (stubkmods == NULL)
+		die("realloc()");
+	if ((stubkmods[nstubkmods++] = strdup(name)) == NULL)
+		die("strdup()");
+	return (0);
+}
+
+/*
+ * Processes the devices of the given inventory snapshot like on startup,
+ * including the Lua functions, but loads no modules, and prints the time
+ * it took. The driver cache is not used.
+ */
+static void
+replay_snapshot(const char *path)
+{
+	double		ms;
+	struct timespec start, end;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	open_drivers_db();
+	pnpindex = load_pnp_index();
+	(void)set_dev_backend("replay", path);
+	if ((devlist = init_devlist()) == NULL)
+		die("init_devlist()");
+	initcfg();
+	process_devs(devlist->devs);
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+	    (end.tv_nsec - start.tv_nsec) / 1000000.0;
+	(void)printf("%zu devices processed in %.3f ms\n", devlist->ndevs, ms);
+}
+
 static void
 lockpidfile()
 {
@@ -356,10 +836,11 @@ uconnect(const char *path)
 	(void)memset(&saddr, (unsigned char)0, sizeof(saddr));
 	(void)snprintf(saddr.sun_path, sizeof(saddr.sun_path), "%s", path);
 	saddr.sun_family = AF_LOCAL;
-	if (connect(s, (struct sockaddr *)&saddr, sizeof(saddr)) == -1)
-		return (-1);
-	if (fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == -1)
+	if (connect(s, (struct sockaddr *)&saddr, sizeof(saddr)) == -1 ||
+	    fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK) == -1) {
+		(void)close(s);
 		return (-1);
+	}
 	return (s);
 }
 
@@ -373,88 +854,221 @@ devd_reconnect(int *sock)
 	logprintx("Connection to devd established");
 }
 
+/*
+ * Connects to devd. Failed attempts are retried for DEVD_RETRY_TIME
+ * seconds. The delay between them doubles up to DEVD_RETRY_MAX ms, and is
+ * randomized, so restarting devd isn't hit by all clients at once.
+ */
 static int
 devd_connect()
 {
-	int  i, s;
+	int	     s;
+	unsigned int ms, delay, waited;
+
+	for (delay = DEVD_RETRY_MIN, waited = 0;;
+	    delay = MIN(delay * 2, DEVD_RETRY_MAX)) {
+		if ((s = uconnect(PATH_DEVD_SOCKET)) != -1)
+			return (s);
+		if (waited >= DEVD_RETRY_TIME * 1000)
+			return (-1);
+		ms = delay / 2 + arc4random_uniform(delay / 2 + 1);
+		(void)usleep(ms * 1000);
+		waited += ms;
+	}
+}
+
+/*
+ * Adds the USB device of a DEVICE ATTACH event to the device list, or
+ * the interface of an INTERFACE ATTACH event to its device. *first is the
+ * index of the first device not processed yet. A processed device which
+ * gets another interface is queued again, so drivers matching the new
+ * interface are found.
+ */
+static void
+add_usb_event_dev(size_t *first)
+{
+	devinfo_t *dev;
 
-	for (i = 0, s = -1; i < 30 && s == -1; i++) {
-		if ((s = uconnect(PATH_DEVD_SOCKET)) == -1)
-			(void)sleep(1);
+	if (strcmp(devdevent.mode, "host") != 0 || devdevent.vendor == -1 ||
+	    devdevent.product == -1 || *devdevent.ugen == '\0')
+		return;
+	dev = find_dev(devlist, devdevent.ugen);
+	if (strcmp(devdevent.subsystem, "DEVICE") == 0) {
+		if (dev != NULL) {
+			if (dev->vendor == devdevent.vendor &&
+			    dev->device == devdevent.product &&
+			    (dev->serial == NULL || *devdevent.sernum == '\0' ||
+			    strcmp(dev->serial, devdevent.sernum) == 0))
+				return;
+			/*
+			 * The ugen name was reused by another device, so we
+			 * missed the DETACH event of the old one.
+			 */
+			remove_dev(dev, first);
+		}
+		(void)add_usb_dev(devlist, devdevent.ugen,
+		    *devdevent.sernum != '\0' ? devdevent.sernum : NULL,
+		    devdevent.vendor, devdevent.product,
+		    MAX(devdevent.devclass, 0), MAX(devdevent.devsubclass, 0));
+		return;
 	}
-	return (s);
+	if (strcmp(devdevent.subsystem, "INTERFACE") != 0 ||
+	    devdevent.intclass == -1 || dev == NULL)
+		return;
+	if (!is_pending(dev, *first))
+		requeue_dev(dev, first);
+	add_iface(dev, devdevent.intclass, MAX(devdevent.intsubclass, 0),
+	    MAX(devdevent.intprotocol, 0));
 }
 
-static char *
-read_devd_event(int s, int *error)
+/*
+ * Moves the given processed device to the end of the processed part of
+ * the device list, and decrements *first, so the device is processed
+ * again. on_remove_device() is called, since on_add_device() will be
+ * called again.
+ */
+static void
+requeue_dev(devinfo_t *dev, size_t *first)
+{
+	size_t i;
+
+	for (i = 0; i < *first && devlist->devs[i] != dev; i++)
+		;
+	if (i == *first)
+		return;
+	call_on_remove_device(dev);
+	devlist->devs[i] = devlist->devs[*first - 1];
+	devlist->devs[--(*first)] = dev;
+}
+
+/*
+ * Removes the USB device of a DEVICE DETACH event from the device list.
+ */
+static void
+remove_usb_event_dev(size_t *first)
 {
-	int	      n, rd;
-	static int    bufsz = 0;
-	static char   seq[1024], *lnbuf = NULL;
-	struct iovec  iov;
-	struct msghdr msg;
+	devinfo_t *dev;
 
-	if (lnbuf == NULL) {
-		if ((lnbuf = malloc(_POSIX2_LINE_MAX)) == NULL)
-			die("malloc()");
-		bufsz = _POSIX2_LINE_MAX;
+	if (strcmp(devdevent.subsystem, "DEVICE") != 0 ||
+	    *devdevent.ugen == '\0')
+		return;
+	if ((dev = find_dev(devlist, devdevent.ugen)) != NULL)
+		remove_dev(dev, first);
+}
+
+/*
+ * Removes the given device from the device list. *first is the index
+ * of the first device not processed yet. It is adjusted if a processed
+ * device was removed. Unprocessed devices are removed without calling
+ * on_remove_device().
+ */
+static void
+remove_dev(devinfo_t *dev, size_t *first)
+{
+	if (!is_pending(dev, *first)) {
+		call_on_remove_device(dev);
+		(*first)--;
 	}
-	iov.iov_len  = sizeof(seq);
-	iov.iov_base = seq;
-	msg.msg_iov  = &iov;
-	msg.msg_iovlen = 1;
+	remove_device(devlist, dev);
+}
 
-	for (n = rd = *error = 0;;) {
-		msg.msg_name    = msg.msg_control = NULL;
-		msg.msg_namelen = msg.msg_controllen = 0;
+/*
+ * Returns true if the given device is at or after index first of the
+ * device list, i.e., was not processed yet.
+ */
+static bool
+is_pending(const devinfo_t *dev, size_t first)
+{
+	size_t i;
 
-		if ((n = recvmsg(s, &msg, 0)) == (ssize_t)-1) {
-			if (errno == EINTR)
-				continue;
-			if (errno == ECONNRESET) {
-				*error = SOCK_ERR_CONN_CLOSED;
-				return (NULL);
-			}
-			if (errno == EAGAIN)
-				return (NULL);
-			die("recvmsg()");
-		} else if (n == 0 && rd == 0) {
-			*error = SOCK_ERR_CONN_CLOSED;
-			return (NULL);
-		}
-		if (rd + n + 1 > bufsz) {
-			if ((lnbuf = realloc(lnbuf, rd + n + 65)) == NULL)
-				die("realloc()");
-			bufsz = rd + n + 65;
-		}
-		(void)memcpy(lnbuf + rd, seq, n);
-		rd += n; lnbuf[rd] = '\0';
-		if (msg.msg_flags & MSG_TRUNC) {
-			logprint("recvmsg(): Message truncated");
-			return (rd > 0 ? lnbuf : NULL);
-		} else if (msg.msg_flags & MSG_EOR)
-			return (lnbuf);
+	for (i = first; i < devlist->ndevs; i++) {
+		if (devlist->devs[i] == dev)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * Adds the PCI device of an ATTACH event to the device list, unless it is
+ * already in it.
+ */
+static void
+add_pci_event_dev()
+{
+	devinfo_t *dev;
+
+	if (devdevent.vendor == -1 || devdevent.product == -1 ||
+	    *devdevent.dbsf == '\0')
+		return;
+	if ((dev = add_pci_dev(devlist, devdevent.dbsf)) == NULL)
+		return;
+	dev->vendor    = devdevent.vendor;
+	dev->device    = devdevent.product;
+	dev->subvendor = MAX(devdevent.subvendor, 0);
+	dev->subdevice = MAX(devdevent.subdevice, 0);
+	if (devdevent.pciclass != -1) {
+		dev->class    = (devdevent.pciclass >> 16) & 0xff;
+		dev->subclass = (devdevent.pciclass >> 8) & 0xff;
 	}
-	return (NULL);
 }
 
+/*
+ * Removes the PCI device of a DETACH event from the device list.
+ */
+static void
+remove_pci_event_dev(size_t *first)
+{
+	devinfo_t *dev;
+
+	if (*devdevent.dbsf == '\0')
+		return;
+	if ((dev = find_dev(devlist, devdevent.dbsf)) != NULL)
+		remove_dev(dev, first);
+}
+
+/*
+ * Parses notify events ("!system=..."), nomatch events of devices
+ * without a driver ("? at <location> pnpinfo <pnpinfo> on <parent>"),
+ * and detach events ("-<name> at <location> on <parent>"). Nomatch and
+ * detach events of devices on a PCI bus are PCI ATTACH and DETACH events.
+ */
 static int
 parse_devd_event(char *str)
 {
-	char *p, *q;
-
-	devdevent.cdev = devdevent.subsystem = "";
-	if (str[0] != '!')
+	char *p, *q, *r;
+	bool nomatch, detach, on;
+
+	devdevent.system = devdevent.type = -1;
+	devdevent.cdev = devdevent.ugen = devdevent.subsystem = "";
+	devdevent.mode = devdevent.sernum = devdevent.dbsf = "";
+	devdevent.vendor = devdevent.product = -1;
+	devdevent.subvendor = devdevent.subdevice = -1;
+	devdevent.pciclass = -1;
+	devdevent.devclass = devdevent.devsubclass = -1;
+	devdevent.intclass = devdevent.intsubclass = -1;
+	devdevent.intprotocol = -1;
+	if (str[0] != '!' && str[0] != '?' && str[0] != '-')
 		return (-1);
+	nomatch = str[0] == '?'; detach = str[0] == '-'; on = false;
 	for (p = str + 1; (p = strtok(p, " \n")) != NULL; p = NULL) {
-		if ((q = strchr(p, '=')) == NULL)
+		if ((q = strchr(p, '=')) == NULL) {
+			if ((nomatch || detach) && on &&
+			    strncmp(p, "pci", 3) == 0 && isdigit(p[3])) {
+				devdevent.system = DEVD_SYSTEM_PCI;
+				devdevent.type	 = nomatch ? DEVD_TYPE_ATTACH :
+				    DEVD_TYPE_DETACH;
+			}
+			on = strcmp(p, "on") == 0;
 			continue;
+		}
 		*q++ = '\0';
 		if (strcmp(p, "system") == 0) {
 			if (strcmp(q, "IFNET") == 0)
 				devdevent.system = DEVD_SYSTEM_IFNET;
 			else if (strcmp(q, "USB") == 0)
 				devdevent.system = DEVD_SYSTEM_USB;
+			else if (strcmp(q, "PCI") == 0)
+				devdevent.system = DEVD_SYSTEM_PCI;
 			else
 				devdevent.system = -1;
 		} else if (strcmp(p, "subsystem") == 0) {
@@ -462,217 +1076,204 @@ parse_devd_event(char *str)
 		} else if (strcmp(p, "type") == 0) {
 			if (strcmp(q, "ATTACH") == 0)
 				devdevent.type = DEVD_TYPE_ATTACH;
+			else if (strcmp(q, "DETACH") == 0)
+				devdevent.type = DEVD_TYPE_DETACH;
 			else
 				devdevent.type = -1;
 		} else if (strcmp(p, "cdev") == 0)
 			devdevent.cdev = q;
+		else if (strcmp(p, "ugen") == 0)
+			devdevent.ugen = q;
+		else if (strcmp(p, "mode") == 0)
+			devdevent.mode = q;
+		else if (strcmp(p, "sernum") == 0) {
+			if (*q == '"' && (r = strrchr(++q, '"')) != NULL)
+				*r = '\0';
+			devdevent.sernum = q;
+		} else if (strcmp(p, "dbsf") == 0)
+			devdevent.dbsf = q;
+		else if (strcmp(p, "vendor") == 0)
+			devdevent.vendor = strtol(q, NULL, 16);
+		else if (strcmp(p, "product") == 0 || strcmp(p, "device") == 0)
+			devdevent.product = strtol(q, NULL, 16);
+		else if (strcmp(p, "subvendor") == 0)
+			devdevent.subvendor = strtol(q, NULL, 16);
+		else if (strcmp(p, "subdevice") == 0)
+			devdevent.subdevice = strtol(q, NULL, 16);
+		else if (strcmp(p, "class") == 0)
+			devdevent.pciclass = strtol(q, NULL, 16);
+		else if (strcmp(p, "devclass") == 0)
+			devdevent.devclass = strtol(q, NULL, 16);
+		else if (strcmp(p, "devsubclass") == 0)
+			devdevent.devsubclass = strtol(q, NULL, 16);
+		else if (strcmp(p, "intclass") == 0)
+			devdevent.intclass = strtol(q, NULL, 16);
+		else if (strcmp(p, "intsubclass") == 0)
+			devdevent.intsubclass = strtol(q, NULL, 16);
+		else if (strcmp(p, "intprotocol") == 0)
+			devdevent.intprotocol = strtol(q, NULL, 16);
         }
 	return (0);
 }
 
+/*
+ * Opens the drivers database. See find_drivers_db().
+ */
 static void
 open_drivers_db()
 {
-	if ((driversdb = fopen(PATH_DRIVERS_DB, "r")) == NULL)
-		die("fopen(%s)", PATH_DRIVERS_DB);
+	if ((driversdb = find_drivers_db()) == NULL)
+		diex("Couldn't open the drivers database");
 }
 
-static void
-initcfg()
+/*
+ * Returns the database compiled into the program, overlaid by the local
+ * drivers database if there is one. The compiled image of the local
+ * database is used if it is up to date, otherwise the text database is
+ * loaded. Without a built-in database, the local database is used alone.
+ */
+static drivers_db_t *
+find_drivers_db()
 {
-	int i;
+	struct stat  src, img;
+	drivers_db_t *db, *builtin;
+
+	db = NULL;
+	if (stat(PATH_DRIVERS_DB_IMAGE, &img) == 0 &&
+	    (stat(PATH_DRIVERS_DB, &src) == -1 ||
+	    img.st_mtime >= src.st_mtime)) {
+		if ((db = map_drivers_db(PATH_DRIVERS_DB_IMAGE)) == NULL)
+			logprint("map_drivers_db(%s)", PATH_DRIVERS_DB_IMAGE);
+	}
+	if (db == NULL && (db = load_drivers_db(PATH_DRIVERS_DB)) == NULL &&
+	    errno != ENOENT) {
+		logprint("load_drivers_db(%s)", PATH_DRIVERS_DB);
+		return (NULL);
+	}
+	if ((builtin = open_builtin_drivers_db()) == NULL) {
+		if (errno != ENOENT)
+			logprint("open_builtin_drivers_db()");
+		return (db);
+	}
+	if (db == NULL)
+		return (builtin);
+	overlay_drivers_db(db, builtin);
 
-	cfg = open_cfg(PATH_CFG_FILE, !dryrun);
-	if (cfg == NULL)
-		return;
-	if (cfg->exclude == NULL)
-		return;
-	if (exclude[0] != NULL)
-		return;
-	if (cfg->exclude_len > MAX_EXCLUDES - 1) {
-		diex("Number of elements in exclude list exceeds %d",
-		    MAX_EXCLUDES - 1);
+	return (db);
+}
+
+/*
+ * Rebuilds the indexes after their files changed. A new index replaces
+ * the old one only after it was completely built, and the old one is
+ * kept if the new one couldn't be built.
+ */
+static void
+reload_indexes()
+{
+	pnp_index_t  *pnp;
+	drivers_db_t *db;
+
+	logprintx("Files changed. Rebuilding indexes");
+	if (is_pnp_index_stale(pnpindex)) {
+		pnp = load_pnp_index();
+		free_pnp_index(pnpindex);
+		pnpindex = pnp;
+	}
+	if ((db = find_drivers_db()) != NULL) {
+		free_drivers_db(driversdb);
+		driversdb = db;
+	}
+	close_id_dbs();
+	/* Let the cache check its dependencies again. */
+	if (devcache != NULL) {
+		free_dev_cache(devcache);
+		open_cache();
 	}
-	for (i = 0; i < MAX_EXCLUDES - 1 && i < cfg->exclude_len; i++)
-		exclude[i] = cfg->exclude[i];
-	exclude[i] = NULL;
 }
 
 /*
- * Returns the first (d != NULL) or next (d == NULL) matching driver for
- * device.
+ * Opens the cache of driver lists and descriptions. It is invalidated if
+ * the program, or any of the databases used for matching or descriptions
+ * changes.
  */
-static char *
-find_driver(const devinfo_t *dev)
+static void
+open_cache()
 {
-	static char *driver = NULL;
-	static uint16_t vendor, device;
+	const char *deps[16];
 
-	if (dev != NULL) {
-		vendor = dev->vendor;
-		device = dev->device;
-	}
-	if (driver == NULL && dev == NULL)
-		return (find_driver_pnp(vendor, device));
-	if ((driver = find_driver_db(dev)) == NULL)
-		return (find_driver(NULL));
-	return (driver);
+	deps[0] = PATH_PROGRAM;
+	(void)get_index_files(&deps[1], sizeof(deps) / sizeof(deps[0]) - 1);
+	devcache = open_dev_cache(PATH_CACHE, deps);
+}
+
+static void
+open_watch()
+{
+	const char *files[16];
+
+	(void)get_index_files(files, sizeof(files) / sizeof(files[0]));
+	if ((filewatch = open_file_watch(files)) == NULL)
+		logprint("open_file_watch()");
 }
 
 /*
- * Returns the first (d != NULL) or next (d == NULL) matching driver for
- * device from the drivers DB.
- */
-static char *
-find_driver_db(const devinfo_t *dev)
-{
-	int	    matching_columns, prev_column, curr_column;
-	bool	    skip;
-	long	    len;
-	char	    ln[_POSIX2_LINE_MAX], *p, *lp;
-	static char *last = NULL;
-	static char driver[_POSIX2_LINE_MAX];
-	static const devinfo_t *curdev = NULL;
-
-	skip = false;
-	if (dev == NULL) {
-		/* Try to find more drivers for previously defined dev. */
-		dev = curdev;
-		if (last != NULL) {
-			p = strtok_r(NULL, "\t ", &last);
-			if (p != NULL)
-				return (p);
-			last = NULL;
-			/* Skip to next driver record. */
-			skip = true;
-		}
-	} else {
-		if (fseek(driversdb, 0, SEEK_SET) == -1)
-			die("fseek()");
-		curdev = dev;
-	}
-	matching_columns = prev_column = 0;
-	while (fgets(ln, sizeof(ln), driversdb) != NULL) {
-		len = strlen(ln);
-		/* Remove '\r', '\n', and '#' */
-		lp = ln;
-		(void)strsep(&lp, "#\r\n");
-		if (ln[0] == '\0') {
-			/* Skip empty lines */
-			continue;
-		}
-		/*
-		 * Count depth (columns/# of tabs). Ignore space characters
-		 * inbetween.
-		 */
-		for (curr_column = 0, lp = ln; *lp != '\0'; lp++) {
-			if (*lp == '\t')
-				curr_column++;
-			else if (*lp != ' ')
-				break;
-		}
-		/* Skip whitespace-only lines */
-		if (*lp == '\0')
-			continue;
-		if (skip && curr_column > 0)
-			continue;
-		else if (skip) {
-			/*
-			 * We skipped all lines so far, and reached the
-			 * the next driver record. Reset "matching_columns"
-			 * and prev_column
-			 */
-			skip = false;
-			prev_column = matching_columns = 0;
-		}
-		if (curr_column < prev_column) {
-			if (curr_column == 0) {
-				/*
-				 * We are at the beginning of a new driver
-				 * record. Get the driver name in the next
-				 * iteration.
-				 */
-				(void)fseek(driversdb, -len, SEEK_CUR);
-			}
-			if (prev_column == matching_columns)
-				return (strtok_r(driver, "\t ", &last));
-			if (curr_column <= matching_columns) {
-				skip = true;
-				continue;
-			}
-		} else if (curr_column == 0) {
-			/*
-			 * At the beginning of a new record. Get the driver
-			 * name.
-			 */
-			matching_columns = prev_column = 0; last = NULL;
-			(void)strncpy(driver, ln, sizeof(driver));
-			continue;
-		} else if (curr_column - matching_columns >= 2)
-			continue;
-		/* Skip leading tabs and spaces */
-		lp = ln + strspn(ln, "\t ");
-		if (*lp == '\0')
-			continue;
-		prev_column = curr_column;
-		if (match_drivers_db_column(dev, lp, curr_column))
-			matching_columns++;
-	}
-	if (matching_columns > 0 && matching_columns >= curr_column)
-		return (strtok_r(driver, "\t ", &last));
-	/* No more drivers found. */
-	return (NULL);
+ * Fills the given list with the paths of the files the indexes are
+ * created from, and terminates it with NULL. Returns the number of
+ * paths.
+ */
+static size_t
+get_index_files(const char **list, size_t size)
+{
+	size_t i, n;
+
+	n = 0;
+	list[n++] = PATH_DRIVERS_DB;
+	list[n++] = PATH_DRIVERS_DB_IMAGE;
+	list[n++] = PATH_PCIID_DB0;
+	list[n++] = PATH_PCIID_DB1;
+	list[n++] = PATH_USBID_DB;
+	for (i = 0; hints_paths[i] != NULL && n < size - 1; i++)
+		list[n++] = hints_paths[i];
+	list[n] = NULL;
+
+	return (n);
 }
 
-static bool
-match_device_column(const devinfo_t *dev, char *colstr)
+static void
+compile_drivers_db(const char *src, const char *dst)
 {
-	char *p;
+	drivers_db_t *db;
 
-	if (*colstr != '*' && strtol(colstr, NULL, 16) != dev->device)
-		return (false);
-	while ((p = strsep(&colstr, "\t ")) != NULL) {
-		if (strncmp(p, "revision=", 9) == 0 &&
-		    strtol(&p[9], NULL, 16) != dev->revision)
-			return (false);
-		else if (strncmp(p, "class=", 6) == 0 &&
-		    strtol(&p[6], NULL, 16) != dev->class)
-			return (false);
-		else if (strncmp(p, "subclass=", 9) == 0 &&
-		    strtol(&p[9], NULL, 16) != dev->subclass)
-			return (false);
-		else if (strncmp(p, "ifclass=", 8) == 0 &&
-		    !match_ifclass(dev, strtol(&p[8], NULL, 16)))
-			return (false);
-		else if (strncmp(p, "ifsubclass=", 11) == 0 &&
-		    !match_ifsubclass(dev, strtol(&p[11], NULL, 16)))
-			return (false);
-		else if (strncmp(p, "protocol=", 9) == 0 &&
-		    !match_ifprotocol(dev, strtol(&p[9], NULL, 16)))
-			return (false);
-	}
-	return (true);
+	if ((db = load_drivers_db(src)) == NULL)
+		die("load_drivers_db(%s)", src);
+	if (write_drivers_db(db, dst) == -1)
+		die("write_drivers_db(%s)", dst);
+	free_drivers_db(db);
 }
 
-static bool
-match_drivers_db_column(const devinfo_t *dev, char *colstr, int colnumber)
+static void
+initcfg()
 {
-	if (colnumber == DB_VENDOR_COLUMN) {
-		if (*colstr == '*' || strtol(colstr, NULL, 16) == dev->vendor)
-			return (true);
-	} else if (colnumber == DB_DEVICE_COLUMN) {
-		if (match_device_column(dev, colstr))
-			return (true);
-	} else if (colnumber == DB_SUBVENDOR_COLUMN) {
-		if (*colstr == '*' ||
-		    strtol(colstr, NULL, 16) == dev->subvendor)
-			return (true);
-	} else if (colnumber == DB_SUBDEVICE_COLUMN) {
-		if (*colstr == '*' ||
-		    strtol(colstr, NULL, 16) == dev->subdevice)
-			return (true);
+	int i;
+
+	cfg = open_cfg(PATH_CFG_FILE, !dryrun);
+	if (cfg == NULL)
+		return;
+	if (cfg->attach_wait >= 0)
+		attach_wait = cfg->attach_wait;
+	if (cfg->attach_wait_max >= 0)
+		attach_wait_max = cfg->attach_wait_max;
+	if (cfg->exclude == NULL)
+		return;
+	if (exclude[0] != NULL)
+		return;
+	if (cfg->exclude_len > MAX_EXCLUDES - 1) {
+		diex("Number of elements in exclude list exceeds %d",
+		    MAX_EXCLUDES - 1);
 	}
-	return (false);
+	for (i = 0; i < MAX_EXCLUDES - 1 && i < cfg->exclude_len; i++)
+		exclude[i] = cfg->exclude[i];
+	exclude[i] = NULL;
 }
 
 static bool
@@ -709,8 +1310,16 @@ static bool
 is_kmod_loaded(const char *name)
 {
 	int		   id, _id;
+	size_t		   i;
 	struct module_stat mstat;
 
+	if (replay) {
+		for (i = 0; i < nstubkmods; i++) {
+			if (strcmp(stubkmods[i], name) == 0)
+				return (true);
+		}
+		return (false);
+	}
 	if (kldfind(name) == -1) {
 		if (errno != ENOENT)
 			logprint("kldfind(%s)", name);
@@ -740,20 +1349,55 @@ is_excluded(const char *kmod)
 	return (false);
 }
 
+/*
+ * Returns the device's description for log and list output, or "" if
+ * there is none.
+ */
+static const char *
+devdescr(devinfo_t *dev)
+{
+	const char *descr;
+
+	descr = resolve_devdescr(dev);
+	return (descr != NULL ? descr : "");
+}
+
+/*
+ * Returns the IDs of the device for log messages. The description is
+ * only added in verbose mode, so the ID databases aren't read otherwise.
+ * The string is valid until the next call.
+ */
+static const char *
+devlabel(devinfo_t *dev)
+{
+	static char label[256];
+
+	if (verbose) {
+		(void)snprintf(label, sizeof(label),
+		    "vendor=%04x product=%04x %s", dev->vendor, dev->device,
+		    devdescr(dev));
+	} else {
+		(void)snprintf(label, sizeof(label),
+		    "vendor=%04x product=%04x", dev->vendor, dev->device);
+	}
+	return (label);
+}
+
+/*
+ * Loads the drivers from the device's driver list, which must have been
+ * filled by match_devlist() before.
+ */
 static void
 load_driver(devinfo_t *dev)
 {
-	char		*driver;
-	const devinfo_t *dp;
+	int	   i;
+	const char *driver;
 
-	for (dp = dev; (driver = find_driver(dp)) != NULL; dp = NULL) {
-		add_driver(dev, driver);
+	for (i = 0; i < dev->ndrivers; i++) {
+		driver = dev->drivers[i];
 		if (is_excluded(driver)) {
-			logprintx("vendor=%04x product=%04x %s: " \
-				  "%s excluded from loading",
-				  dev->vendor, dev->device,
-				  dev->descr != NULL ? dev->descr : "",
-				  driver);
+			logprintx("%s: %s excluded from loading",
+			    devlabel(dev), driver);
 			continue;
 		}
 		if (cfg != NULL && !dryrun) {
@@ -761,25 +1405,20 @@ load_driver(devinfo_t *dev)
 				continue;
 		}
 		if (!is_kmod_loaded(driver)) {
-			logprintx("vendor=%04x product=%04x %s: " \
-			    "Loading %s", dev->vendor, dev->device,
-			    dev->descr != NULL ? dev->descr : "", driver);
-			if (!dryrun && kldload(driver) == -1)
+			logprintx("%s: Loading %s", devlabel(dev), driver);
+			if (!dryrun && load_kmod(driver) == -1)
 				logprint("kldload(%s)", driver);
 			if (cfg != NULL && !dryrun) {
 				(void)call_cfg_function(cfg, "on_load_kmod",
 				    dev, driver);
 			}
 		} else {
-			logprintx("vendor=%04x product=%04x %s: %s already " \
-			    "loaded", dev->vendor, dev->device,
-			    dev->descr != NULL ? dev->descr : "", driver);
+			logprintx("%s: %s already loaded", devlabel(dev),
+			    driver);
 		}
 	}
-	if (dp != NULL) {
-		logprintx("vendor=%04x product=%04x %s: No driver found",
-		    dev->vendor, dev->device,
-		    dev->descr != NULL ? dev->descr : "");
+	if (dev->ndrivers == 0) {
+		logprintx("%s: No driver found", devlabel(dev));
 	}
 	/* We are done with this device */
 	if (cfg != NULL && !dryrun)
@@ -787,39 +1426,36 @@ load_driver(devinfo_t *dev)
 }
 
 static void
-print_devinfo(const devinfo_t *dev)
+print_devinfo(devinfo_t *dev)
 {
-	char   **driver_list;
-	size_t i, ndrivers;
+	int i;
 
-	driver_list = create_driver_list(dev, &ndrivers);
-	for (i = 0; i < ndrivers; i++) {
+	for (i = 0; i < dev->ndrivers; i++) {
 		if (dev->bus == BUS_TYPE_PCI)
-			print_pci_devinfo(dev, driver_list[i]);
+			print_pci_devinfo(dev, dev->drivers[i]);
 		else if (dev->bus == BUS_TYPE_USB)
-			print_usb_devinfo(dev, driver_list[i]);
-		free(driver_list[i]);
+			print_usb_devinfo(dev, dev->drivers[i]);
 	}
 }
 
 static void
-print_pci_devinfo(const devinfo_t *dev, const char *driver)
+print_pci_devinfo(devinfo_t *dev, const char *driver)
 {
 	(void)printf("vendor=%04x product=%04x " \
 	    "class=%02x subclass=%02x bus=PCI %s: %s\n",
 	    dev->vendor, dev->device, dev->class, dev->subclass,
-	    dev->descr != NULL ? dev->descr : "", driver);
+	    devdescr(dev), driver);
 }
 
 static void
-print_usb_devinfo(const devinfo_t *dev, const char *driver)
+print_usb_devinfo(devinfo_t *dev, const char *driver)
 {
 	int i;
 
 	(void)printf("vendor=%04x product=%04x " \
 	    "class=%02x subclass=%02x bus=USB %s: %s\n",
 	    dev->vendor, dev->device, dev->class, dev->subclass,
-	    dev->descr != NULL ? dev->descr : "", driver);
+	    devdescr(dev), driver);
 	for (i = 0; i < dev->nifaces; i++) {
 		(void)printf("vendor=%04x product=%04x "    \
 		    "ifclass=%02x ifsubclass=%02x bus=USB " \
@@ -827,6 +1463,41 @@ print_usb_devinfo(const devinfo_t *dev, const char *driver)
 		    dev->vendor, dev->device,
 		    dev->iface[i].class, dev->iface[i].subclass,
 		    dev->iface[i].protocol,
-		    dev->descr != NULL ? dev->descr : "", driver);
+		    devdescr(dev), driver);
+	}
+}
+
+/*
+ * Prints a line with all IDs and the location of the device, followed by
+ * a line for each interface of USB devices. Unlike print_devinfo(), each
+ * device is printed once, with its drivers separated by commas, including
+ * devices without drivers.
+ */
+static void
+print_inventory(FILE *fp, devinfo_t *dev)
+{
+	int	   i;
+	const char *bus, *key, *location;
+
+	if (dev->bus == BUS_TYPE_USB) {
+		bus = "USB"; key = "ugen"; location = dev->ugen;
+	} else {
+		bus = "PCI"; key = "sel"; location = dev->pcisel;
+	}
+	(void)fprintf(fp, "vendor=%04x product=%04x subvendor=%04x "	\
+	    "subdevice=%04x revision=%02x class=%02x subclass=%02x bus=%s",
+	    dev->vendor, dev->device, dev->subvendor, dev->subdevice,
+	    dev->revision, dev->class, dev->subclass, bus);
+	if (location != NULL)
+		(void)fprintf(fp, " %s=%s", key, location);
+	(void)fprintf(fp, " %s:", devdescr(dev));
+	for (i = 0; i < dev->ndrivers; i++)
+		(void)fprintf(fp, "%s%s", i > 0 ? "," : " ", dev->drivers[i]);
+	(void)fputc('\n', fp);
+	for (i = 0; i < dev->nifaces; i++) {
+		(void)fprintf(fp, "vendor=%04x product=%04x "		\
+		    "ifclass=%02x ifsubclass=%02x protocol=%02x bus=USB\n",
+		    dev->vendor, dev->device, dev->iface[i].class,
+		    dev->iface[i].subclass, dev->iface[i].protocol);
 	}
 }
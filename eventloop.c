@@ -0,0 +1,395 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/types.h>
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+# include <sys/timerfd.h>
+#else
+# include <sys/event.h>
+#endif
+
+#include "log.h"
+#include "eventloop.h"
+
+#define MAX_EVENTS 16		/* Max. # of events per dispatch */
+
+enum EVENT_KIND { EVENT_FD, EVENT_TIMER, EVENT_SIGNAL };
+
+/*
+ * A watched fd, timer, or signal. The kernel event refers to it, so events
+ * are dispatched without a lookup.
+ */
+typedef struct event_source_s {
+	int	kind;
+	int	ident;			/* fd, timer ID, or signal number */
+	int	fd;			/* fd, timerfd or signalfd (Linux) */
+	bool	periodic;		/* Timer restarts after expiring */
+	bool	removed;		/* Events may still be pending */
+	void	*arg;
+	event_handler_t handler;
+	struct event_source_s *next;
+} event_source_t;
+
+struct event_loop_s {
+	int	       fd;		/* kqueue or epoll fd */
+	event_source_t *sources;
+	event_source_t *removed;	/* Freed after dispatching */
+};
+
+static int	      register_source(event_loop_t *, event_source_t *,
+			unsigned int);
+static void	      remove_source(event_loop_t *, event_source_t *);
+static void	      free_removed_sources(event_loop_t *);
+static event_source_t *add_source(event_loop_t *, int, int, event_handler_t,
+			void *);
+static event_source_t *find_source(event_loop_t *, int, int);
+
+event_loop_t *
+create_event_loop()
+{
+	event_loop_t *loop;
+
+	if ((loop = malloc(sizeof(event_loop_t))) == NULL)
+		return (NULL);
+	(void)memset(loop, 0, sizeof(event_loop_t));
+#ifdef __linux__
+	loop->fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+	loop->fd = kqueue();
+#endif
+	if (loop->fd == -1) {
+		free(loop);
+		return (NULL);
+	}
+	return (loop);
+}
+
+void
+free_event_loop(event_loop_t *loop)
+{
+	if (loop == NULL)
+		return;
+	while (loop->sources != NULL)
+		remove_source(loop, loop->sources);
+	free_removed_sources(loop);
+	(void)close(loop->fd);
+	free(loop);
+}
+
+/*
+ * Calls the given handler whenever fd is readable. Replaces a previous
+ * handler of fd.
+ */
+int
+watch_fd(event_loop_t *loop, int fd, event_handler_t handler, void *arg)
+{
+	unwatch_fd(loop, fd);
+	if (add_source(loop, EVENT_FD, fd, handler, arg) == NULL)
+		return (-1);
+	return (0);
+}
+
+void
+unwatch_fd(event_loop_t *loop, int fd)
+{
+	event_source_t *src;
+
+	if ((src = find_source(loop, EVENT_FD, fd)) != NULL)
+		remove_source(loop, src);
+}
+
+/*
+ * Calls the given handler whenever the signal arrives, instead of the
+ * signal's default action.
+ */
+int
+watch_signal(event_loop_t *loop, int sig, event_handler_t handler, void *arg)
+{
+	unwatch_signal(loop, sig);
+	if (add_source(loop, EVENT_SIGNAL, sig, handler, arg) == NULL)
+		return (-1);
+	return (0);
+}
+
+void
+unwatch_signal(event_loop_t *loop, int sig)
+{
+	event_source_t *src;
+
+	if ((src = find_source(loop, EVENT_SIGNAL, sig)) != NULL)
+		remove_source(loop, src);
+}
+
+/*
+ * Calls the given handler after ms milliseconds, and every ms milliseconds
+ * thereafter if periodic is true. If a timer with the given ID is already
+ * set, it is replaced.
+ */
+int
+set_timer(event_loop_t *loop, int id, unsigned int ms, bool periodic,
+	event_handler_t handler, void *arg)
+{
+	event_source_t *src;
+
+	cancel_timer(loop, id);
+	if ((src = add_source(loop, EVENT_TIMER, id, NULL, NULL)) == NULL)
+		return (-1);
+	src->periodic = periodic;
+	src->handler  = handler;
+	src->arg      = arg;
+	if (register_source(loop, src, ms) == -1) {
+		remove_source(loop, src);
+		return (-1);
+	}
+	return (0);
+}
+
+void
+cancel_timer(event_loop_t *loop, int id)
+{
+	event_source_t *src;
+
+	if ((src = find_source(loop, EVENT_TIMER, id)) != NULL)
+		remove_source(loop, src);
+}
+
+/*
+ * Waits for events, and calls their handlers. Expired one-shot timers are
+ * removed before their handler is called, so the handler may set them
+ * again.
+ */
+void
+dispatch_events(event_loop_t *loop)
+{
+	int	       i, n;
+	event_source_t *src;
+#ifdef __linux__
+	uint64_t       expirations;
+	struct epoll_event ev[MAX_EVENTS];
+	struct signalfd_siginfo si;
+
+	n = epoll_wait(loop->fd, ev, MAX_EVENTS, -1);
+#else
+	struct kevent  ev[MAX_EVENTS];
+
+	n = kevent(loop->fd, NULL, 0, ev, MAX_EVENTS, NULL);
+#endif
+	if (n == -1) {
+		if (errno != EINTR)
+#ifdef __linux__
+			die("epoll_wait()");
+#else
+			die("kevent()");
+#endif
+		return;
+	}
+	for (i = 0; i < n; i++) {
+#ifdef __linux__
+		src = ev[i].data.ptr;
+#else
+		src = ev[i].udata;
+#endif
+		if (src->removed)
+			continue;
+#ifdef __linux__
+		if (src->kind == EVENT_TIMER)
+			(void)read(src->fd, &expirations, sizeof(expirations));
+		else if (src->kind == EVENT_SIGNAL)
+			(void)read(src->fd, &si, sizeof(si));
+#endif
+		if (src->kind == EVENT_TIMER && !src->periodic)
+			remove_source(loop, src);
+		src->handler(src->arg);
+	}
+	free_removed_sources(loop);
+}
+
+static event_source_t *
+find_source(event_loop_t *loop, int kind, int ident)
+{
+	event_source_t *src;
+
+	for (src = loop->sources; src != NULL; src = src->next) {
+		if (src->kind == kind && src->ident == ident)
+			return (src);
+	}
+	return (NULL);
+}
+
+/*
+ * Creates a new event source, and adds it to the loop. Timers are
+ * registered by the caller.
+ */
+static event_source_t *
+add_source(event_loop_t *loop, int kind, int ident, event_handler_t handler,
+	void *arg)
+{
+	event_source_t *src;
+
+	if ((src = malloc(sizeof(event_source_t))) == NULL)
+		return (NULL);
+	(void)memset(src, 0, sizeof(event_source_t));
+	src->kind    = kind;
+	src->ident   = ident;
+	src->fd      = -1;
+	src->handler = handler;
+	src->arg     = arg;
+	src->next    = loop->sources;
+	loop->sources = src;
+	if (kind != EVENT_TIMER && register_source(loop, src, 0) == -1) {
+		remove_source(loop, src);
+		return (NULL);
+	}
+	return (src);
+}
+
+/*
+ * Registers the event source with the kernel. ms is the timeout of
+ * timers.
+ */
+static int
+register_source(event_loop_t *loop, event_source_t *src, unsigned int ms)
+{
+#ifdef __linux__
+	sigset_t	   set;
+	struct itimerspec  its;
+	struct epoll_event ev;
+
+	switch (src->kind) {
+	case EVENT_FD:
+		src->fd = src->ident;
+		break;
+	case EVENT_TIMER:
+		src->fd = timerfd_create(CLOCK_MONOTONIC,
+		    TFD_NONBLOCK | TFD_CLOEXEC);
+		if (src->fd == -1)
+			return (-1);
+		(void)memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec  = ms / 1000;
+		its.it_value.tv_nsec = (ms % 1000) * 1000000;
+		/* A zero it_value would disarm the timer. */
+		if (ms == 0)
+			its.it_value.tv_nsec = 1;
+		if (src->periodic)
+			its.it_interval = its.it_value;
+		if (timerfd_settime(src->fd, 0, &its, NULL) == -1)
+			return (-1);
+		break;
+	case EVENT_SIGNAL:
+		(void)sigemptyset(&set);
+		(void)sigaddset(&set, src->ident);
+		if (sigprocmask(SIG_BLOCK, &set, NULL) == -1)
+			return (-1);
+		src->fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+		if (src->fd == -1)
+			return (-1);
+		break;
+	}
+	(void)memset(&ev, 0, sizeof(ev));
+	ev.events   = EPOLLIN;
+	ev.data.ptr = src;
+	return (epoll_ctl(loop->fd, EPOLL_CTL_ADD, src->fd, &ev));
+#else
+	struct kevent ev;
+
+	switch (src->kind) {
+	case EVENT_FD:
+		EV_SET(&ev, src->ident, EVFILT_READ, EV_ADD, 0, 0, src);
+		break;
+	case EVENT_TIMER:
+		EV_SET(&ev, src->ident, EVFILT_TIMER,
+		    EV_ADD | (src->periodic ? 0 : EV_ONESHOT), 0, ms, src);
+		break;
+	case EVENT_SIGNAL:
+		/* The signal must not be handled otherwise. */
+		if (signal(src->ident, SIG_IGN) == SIG_ERR)
+			return (-1);
+		EV_SET(&ev, src->ident, EVFILT_SIGNAL, EV_ADD, 0, 0, src);
+		break;
+	}
+	return (kevent(loop->fd, &ev, 1, NULL, 0, NULL));
+#endif
+}
+
+/*
+ * Unregisters the event source, and removes it from the loop. Its memory
+ * is freed after dispatching the current events, which may refer to it.
+ */
+static void
+remove_source(event_loop_t *loop, event_source_t *src)
+{
+	event_source_t **p;
+#ifdef __linux__
+	sigset_t set;
+
+	if (src->fd != -1)
+		(void)epoll_ctl(loop->fd, EPOLL_CTL_DEL, src->fd, NULL);
+	if (src->kind == EVENT_SIGNAL) {
+		(void)sigemptyset(&set);
+		(void)sigaddset(&set, src->ident);
+		(void)sigprocmask(SIG_UNBLOCK, &set, NULL);
+	}
+	if (src->kind != EVENT_FD && src->fd != -1)
+		(void)close(src->fd);
+#else
+	struct kevent ev;
+	static const short filter[] = {
+		[EVENT_FD] = EVFILT_READ, [EVENT_TIMER] = EVFILT_TIMER,
+		[EVENT_SIGNAL] = EVFILT_SIGNAL
+	};
+
+	/* Fails for expired one-shot timers, and closed fds. */
+	EV_SET(&ev, src->ident, filter[src->kind], EV_DELETE, 0, 0, NULL);
+	(void)kevent(loop->fd, &ev, 1, NULL, 0, NULL);
+	if (src->kind == EVENT_SIGNAL)
+		(void)signal(src->ident, SIG_DFL);
+#endif
+	for (p = &loop->sources; *p != NULL && *p != src; p = &(*p)->next)
+		;
+	if (*p != NULL)
+		*p = src->next;
+	src->removed = true;
+	src->next    = loop->removed;
+	loop->removed = src;
+}
+
+static void
+free_removed_sources(event_loop_t *loop)
+{
+	event_source_t *src, *next;
+
+	for (src = loop->removed; src != NULL; src = next) {
+		next = src->next;
+		free(src);
+	}
+	loop->removed = NULL;
+}
@@ -0,0 +1,49 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _EVENTLOOP_H_
+#define _EVENTLOOP_H_
+#include <stdbool.h>
+
+/*
+ * Event loop which calls handler functions when a file descriptor becomes
+ * readable, a timer expires, or a signal arrives. It uses kqueue, or
+ * epoll, timerfd and signalfd on Linux. Timers use a monotonic clock, and
+ * are identified by an ID chosen by the caller. Setting a timer again
+ * restarts it.
+ */
+typedef struct event_loop_s event_loop_t;
+typedef void (*event_handler_t)(void *);
+
+extern int	    watch_fd(event_loop_t *, int, event_handler_t, void *);
+extern int	    watch_signal(event_loop_t *, int, event_handler_t, void *);
+extern int	    set_timer(event_loop_t *, int, unsigned int, bool,
+			event_handler_t, void *);
+extern void	    unwatch_fd(event_loop_t *, int);
+extern void	    unwatch_signal(event_loop_t *, int);
+extern void	    cancel_timer(event_loop_t *, int);
+extern void	    dispatch_events(event_loop_t *);
+extern void	    free_event_loop(event_loop_t *);
+extern event_loop_t *create_event_loop(void);
+#endif
@@ -0,0 +1,247 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef __linux__
+# include <sys/inotify.h>
+#else
+# include <sys/event.h>
+#endif
+
+#include "log.h"
+#include "filewatch.h"
+
+#ifdef __linux__
+# define DIR_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		     IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB)
+#else
+# define DIR_EVENTS  (NOTE_WRITE | NOTE_DELETE | NOTE_RENAME)
+# define FILE_EVENTS (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | \
+		      NOTE_RENAME)
+#endif
+
+typedef struct watched_file_s {
+	int  wd;		/* inotify watch descriptor of dir, or -1 */
+	int  dirfd;		/* Descriptor of dir for kqueue, or -1 */
+	int  fd;		/* Descriptor of file for kqueue, or -1 */
+	char *path;
+	char *dir;		/* Directory containing the file */
+	char *name;		/* File name without directory */
+} watched_file_t;
+
+struct file_watch_s {
+	int	       fd;	/* kqueue or inotify descriptor */
+	size_t	       nfiles;
+	watched_file_t *files;
+};
+
+static void arm_file_watch(file_watch_t *);
+static void disarm_file_watch(file_watch_t *);
+
+/*
+ * Creates a watch for the files of the given NULL-terminated list. On
+ * error, NULL is returned, and errno is set.
+ */
+file_watch_t *
+open_file_watch(const char **paths)
+{
+	char	       *p;
+	size_t	       i;
+	file_watch_t   *fw;
+	watched_file_t *wf;
+
+	if ((fw = malloc(sizeof(file_watch_t))) == NULL)
+		die("malloc()");
+	for (fw->nfiles = 0; paths[fw->nfiles] != NULL; fw->nfiles++)
+		;
+	if ((fw->files = calloc(fw->nfiles, sizeof(watched_file_t))) == NULL)
+		die("calloc()");
+	for (i = 0; i < fw->nfiles; i++) {
+		wf = &fw->files[i];
+		wf->wd = wf->dirfd = wf->fd = -1;
+		if ((wf->path = strdup(paths[i])) == NULL ||
+		    (wf->dir = strdup(paths[i])) == NULL)
+			die("strdup()");
+		if ((p = strrchr(wf->dir, '/')) == NULL) {
+			free(wf->dir);
+			if ((wf->dir = strdup(".")) == NULL)
+				die("strdup()");
+			wf->name = wf->path;
+		} else {
+			wf->name = wf->path + (p - wf->dir) + 1;
+			p[p == wf->dir ? 1 : 0] = '\0';
+		}
+	}
+#ifdef __linux__
+	fw->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	fw->fd = kqueue();
+#endif
+	if (fw->fd == -1) {
+		free_file_watch(fw);
+		return (NULL);
+	}
+	arm_file_watch(fw);
+
+	return (fw);
+}
+
+void
+free_file_watch(file_watch_t *fw)
+{
+	size_t i;
+
+	if (fw == NULL)
+		return;
+	disarm_file_watch(fw);
+	if (fw->fd != -1)
+		(void)close(fw->fd);
+	for (i = 0; i < fw->nfiles; i++) {
+		free(fw->files[i].path);
+		free(fw->files[i].dir);
+	}
+	free(fw->files);
+	free(fw);
+}
+
+/*
+ * Returns the descriptor to wait on with select() or poll().
+ */
+int
+file_watch_fd(const file_watch_t *fw)
+{
+	return (fw->fd);
+}
+
+/*
+ * Reads all pending events without blocking. Returns true if any of the
+ * watched files may have changed. With kqueue, changes of other files in
+ * the same directories are reported as well.
+ */
+bool
+read_file_watch(file_watch_t *fw)
+{
+	bool   changed;
+#ifdef __linux__
+	char   *p, buf[4096] __attribute__((aligned(8)));
+	size_t i;
+	ssize_t n;
+	struct inotify_event *ev;
+
+	for (changed = false; (n = read(fw->fd, buf, sizeof(buf))) > 0;) {
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (struct inotify_event *)p;
+			for (i = 0; ev->len > 0 && i < fw->nfiles; i++) {
+				if (fw->files[i].wd == ev->wd &&
+				    strcmp(fw->files[i].name, ev->name) == 0)
+					changed = true;
+			}
+		}
+	}
+	if (n == -1 && errno != EAGAIN && errno != EINTR)
+		die("read()");
+#else
+	int		n;
+	struct kevent	ev[8];
+	struct timespec	ts = { 0, 0 };
+
+	for (changed = false;
+	    (n = kevent(fw->fd, NULL, 0, ev, sizeof(ev) / sizeof(ev[0]),
+	    &ts)) > 0;)
+		changed = true;
+	if (n == -1 && errno != EINTR)
+		die("kevent()");
+	if (changed) {
+		/*
+		 * Files may have been created or replaced. Watch the
+		 * current ones.
+		 */
+		disarm_file_watch(fw);
+		arm_file_watch(fw);
+	}
+#endif
+	return (changed);
+}
+
+/*
+ * Watches the directory of each file, and the file itself if it exists.
+ * The directory watch catches files which are created, deleted, or
+ * renamed. Nonexistent directories are not watched.
+ */
+static void
+arm_file_watch(file_watch_t *fw)
+{
+	size_t	       i;
+	watched_file_t *wf;
+#ifndef __linux__
+	struct kevent  ev;
+#endif
+
+	for (i = 0; i < fw->nfiles; i++) {
+		wf = &fw->files[i];
+#ifdef __linux__
+		wf->wd = inotify_add_watch(fw->fd, wf->dir, DIR_EVENTS);
+#else
+		wf->dirfd = open(wf->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (wf->dirfd != -1) {
+			EV_SET(&ev, wf->dirfd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+			    DIR_EVENTS, 0, NULL);
+			if (kevent(fw->fd, &ev, 1, NULL, 0, NULL) == -1)
+				die("kevent()");
+		}
+		if ((wf->fd = open(wf->path, O_RDONLY | O_CLOEXEC)) == -1)
+			continue;
+		EV_SET(&ev, wf->fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+		    FILE_EVENTS, 0, NULL);
+		if (kevent(fw->fd, &ev, 1, NULL, 0, NULL) == -1)
+			die("kevent()");
+#endif
+	}
+}
+
+static void
+disarm_file_watch(file_watch_t *fw)
+{
+	size_t	       i;
+	watched_file_t *wf;
+
+	for (i = 0; i < fw->nfiles; i++) {
+		wf = &fw->files[i];
+#ifdef __linux__
+		/* Several files can share one directory watch. */
+		if (wf->wd != -1)
+			(void)inotify_rm_watch(fw->fd, wf->wd);
+#endif
+		if (wf->dirfd != -1)
+			(void)close(wf->dirfd);
+		if (wf->fd != -1)
+			(void)close(wf->fd);
+		wf->wd = wf->dirfd = wf->fd = -1;
+	}
+}
@@ -24,31 +24,111 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <err.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/module.h>
 #include <sys/linker.h>
 
 #include "log.h"
+#include "hints.h"
 
 #define ERROR(ret, fmt, ...) do { \
 	warnx(fmt, ##__VA_ARGS__); \
 	return (ret); \
 } while (0)
 
+#define PNP_MAX_FIELDS	   32
+
+/*
+ * Fields of the PNP format strings used for matching.
+ */
+enum PNP_FIELD {
+	PNP_FIELD_VENDOR, PNP_FIELD_DEVICE, PNP_FIELD_SUBVENDOR,
+	PNP_FIELD_SUBDEVICE, PNP_FIELD_CLASS, PNP_FIELD_SUBCLASS,
+	PNP_FIELD_IFCLASS, PNP_FIELD_IFSUBCLASS, PNP_FIELD_IFPROTOCOL,
+	PNP_NFIELDS
+};
+
+#define PNP_MATCH(f)	   (1 << (f))
+#define PNP_MATCH_IFACE	   (PNP_MATCH(PNP_FIELD_IFCLASS)    | \
+			    PNP_MATCH(PNP_FIELD_IFSUBCLASS) | \
+			    PNP_MATCH(PNP_FIELD_IFPROTOCOL))
+
+static const struct pnp_field_name_s {
+	const char *name;
+	int	   field;
+} pnp_field_names[] = {
+	{ "vendor",	  PNP_FIELD_VENDOR     },
+	{ "device",	  PNP_FIELD_DEVICE     },
+	{ "product",	  PNP_FIELD_DEVICE     },
+	{ "subvendor",	  PNP_FIELD_SUBVENDOR  },
+	{ "subdevice",	  PNP_FIELD_SUBDEVICE  },
+	{ "class",	  PNP_FIELD_CLASS      },
+	{ "subclass",	  PNP_FIELD_SUBCLASS   },
+	{ "devclass",	  PNP_FIELD_CLASS      },
+	{ "devsubclass",  PNP_FIELD_SUBCLASS   },
+	{ "intclass",	  PNP_FIELD_IFCLASS    },
+	{ "intsubclass",  PNP_FIELD_IFSUBCLASS },
+	{ "intprotocol",  PNP_FIELD_IFPROTOCOL }
+};
+
+/*
+ * Operations to decode the fields of a PNP record.
+ */
+enum PNP_OP {
+	PNP_OP_SKIP_INT,	/* Integer not used for matching */
+	PNP_OP_SKIP_STR,	/* String */
+	PNP_OP_MASK,		/* Mask selecting the following fields */
+	PNP_OP_INT,		/* Integer to match */
+	PNP_OP_INT_ANY		/* Integer to match, or -1 to match any */
+};
+
+typedef struct pnp_op_s {
+	uint8_t	op;		/* PNP_OP_* */
+	int8_t	field;		/* PNP_FIELD_* of PNP_OP_INT* */
+	int8_t	bit;		/* Bit in the record's mask or -1 */
+} pnp_op_t;
+
+/*
+ * Values of a PNP record to compare with a device. Only fields with their
+ * bit set in "match" are compared.
+ */
+typedef struct pnp_rec_s {
+	uint16_t match;			/* PNP_MATCH(PNP_FIELD_*) bits */
+	uint16_t val[PNP_NFIELDS];
+} pnp_rec_t;
+
+/*
+ * Compiled format string of PNP info lists. Lists with the same bus and
+ * format string share one format.
+ */
+typedef struct pnp_format_s {
+	int	  bus;		/* BUS_TYPE_PCI or BUS_TYPE_USB */
+	int	  nops;		/* # of operations per record */
+	bool	  unused;	/* Skip lists of this format */
+	char	  *str;		/* Format string */
+	size_t	  len;
+	pnp_rec_t defaults;	/* Values set via T fields */
+	pnp_op_t  ops[PNP_MAX_FIELDS];
+	struct pnp_format_s *next;	/* Next format in hash bucket */
+} pnp_format_t;
+
+#define PNP_FORMAT_BUCKETS 256
+
+typedef struct pnp_format_tbl_s {
+	pnp_format_t *bucket[PNP_FORMAT_BUCKETS];
+} pnp_format_tbl_t;
+
 typedef struct pnp_info_list_s {
-	int    vidx;		/* Index of "vendor" value in records. */
-	int    didx;		/* Index of "device" value in records. */
-	int    vendor;		/* Global "vendor" value for all records. */
-	int    recsleft;	/* Remaining records */
-	char   bus[16];		/* Bus name (e.g. "pci", "usb") */
-	char   format[256];	/* Format string to parse the following recs */
-	char   *rec;		/* Start of current record */
+	int		   recsleft;	/* Remaining records */
+	const pnp_format_t *fmt;
 } pnp_info_list_t;
 
 typedef struct hints_file_s {
@@ -60,172 +140,557 @@ typedef struct hints_file_s {
 	size_t size;		/* Size of buf/hints file */
 } hints_file_t;
 
+/*
+ * A record of a module's PNP info list. The index is sorted by bus and
+ * key, and entries with equal keys are kept in the order their lists
+ * appear in the hints files.
+ */
+typedef struct pnp_entry_s {
+	uint32_t  key;		/* vendor << 16 | device */
+	uint32_t  seq;		/* Number of the PNP info list */
+	uint32_t  kmod;		/* Index of the module name */
+	uint8_t	  bus;
+	pnp_rec_t rec;
+} pnp_entry_t;
+
+/*
+ * Modification time and size of a hints file at the time it was read.
+ * Both are -1 if the file didn't exist.
+ */
+typedef struct hints_stamp_s {
+	intmax_t mtime;
+	intmax_t size;
+} hints_stamp_t;
+
+/*
+ * Records which match any vendor or device ID (e.g. USB class drivers)
+ * are kept in the separate list "wildcards", in the order they appear in
+ * the hints files.
+ */
+struct pnp_index_s {
+	char	      **kmods;	/* Module names */
+	size_t	      nkmods;
+	size_t	      kmodsz;
+	pnp_entry_t   *entries;
+	size_t	      nentries;
+	size_t	      entriesz;
+	pnp_entry_t   *wildcards;
+	size_t	      nwildcards;
+	size_t	      wildcardsz;
+	size_t	      nlists;	/* # of PNP info lists read */
+	hints_stamp_t *stamps;	/* One for each hints_paths[] element */
+};
+
 static int  readint(hints_file_t *);
-static int  init_pnp_info_list(hints_file_t *, pnp_info_list_t *);
-static int  read_pnp_record(hints_file_t *, pnp_info_list_t *, int *, int *);
+static int  entrycmp(const void *, const void *);
+static int  lookup_field(const char *, size_t);
+static int  parse_t_field(pnp_format_t *, const char *, size_t);
+static int  init_pnp_info_list(hints_file_t *, pnp_format_tbl_t *,
+		pnp_info_list_t *);
+static int  read_pnp_record(hints_file_t *, pnp_info_list_t *, pnp_rec_t *);
+static int  read_kmod_name(hints_file_t *, char *, size_t);
+static bool match_pnp_rec(const pnp_rec_t *, const devinfo_t *);
 static char *readstr(hints_file_t *, size_t *);
 static char *nextrec(hints_file_t *);
-static char *next_matching(hints_file_t *hf, uint16_t vendor, uint16_t device);
-static void free_hints_file(hints_file_t *);
-static hints_file_t *read_hints_file(const char *);
+static void get_stamp(const char *, hints_stamp_t *);
+static void index_hints_file(pnp_index_t *, pnp_format_tbl_t *,
+		hints_file_t *);
+static void compile_pnp_format(pnp_format_t *);
+static void free_pnp_formats(pnp_format_tbl_t *);
+static void unmap_hints_file(hints_file_t *);
+static void add_entry(pnp_entry_t **, size_t *, size_t *, const pnp_entry_t *);
+static hints_file_t *map_hints_file(const char *);
+static pnp_format_t *get_pnp_format(pnp_format_tbl_t *, int, const char *,
+		size_t);
 
-static const char *hints_paths[] = {
+const char *hints_paths[] = {
 	"/boot/kernel/linker.hints", "/boot/modules/linker.hints", NULL
 };
 
 /*
- * With each call, the function returns the next kernel module name for the
- * given vendor and device ID from the hints files in hints_paths[]. If no
- * further matching modules could be found, NULL is returned.
+ * Reads the PNP records of all modules from the hints files in
+ * hints_paths[], and creates an index of them. The files are not needed
+ * for lookups afterwards.
+ */
+pnp_index_t *
+load_pnp_index()
+{
+	int		 i;
+	hints_file_t	 *hf;
+	pnp_index_t	 *idx;
+	pnp_format_tbl_t fmts;
+
+	if ((idx = malloc(sizeof(pnp_index_t))) == NULL)
+		die("malloc()");
+	(void)memset(idx, 0, sizeof(pnp_index_t));
+	for (i = 0; hints_paths[i] != NULL; i++)
+		;
+	if ((idx->stamps = malloc(i * sizeof(hints_stamp_t))) == NULL)
+		die("malloc()");
+	(void)memset(&fmts, 0, sizeof(fmts));
+	for (i = 0; hints_paths[i] != NULL; i++) {
+		get_stamp(hints_paths[i], &idx->stamps[i]);
+		if ((hf = map_hints_file(hints_paths[i])) == NULL)
+			continue;
+		index_hints_file(idx, &fmts, hf);
+		unmap_hints_file(hf);
+	}
+	free_pnp_formats(&fmts);
+	qsort(idx->entries, idx->nentries, sizeof(pnp_entry_t), entrycmp);
+
+	return (idx);
+}
+
+void
+free_pnp_index(pnp_index_t *idx)
+{
+	size_t i;
+
+	if (idx == NULL)
+		return;
+	for (i = 0; i < idx->nkmods; i++)
+		free(idx->kmods[i]);
+	free(idx->kmods);
+	free(idx->entries);
+	free(idx->wildcards);
+	free(idx->stamps);
+	free(idx);
+}
+
+/*
+ * Returns true if any of the hints files changed since the index was
+ * created.
  */
-char *
-find_driver_pnp(uint16_t vendor, uint16_t device)
+bool
+is_pnp_index_stale(const pnp_index_t *idx)
+{
+	int	      i;
+	hints_stamp_t stamp;
+
+	for (i = 0; hints_paths[i] != NULL; i++) {
+		get_stamp(hints_paths[i], &stamp);
+		if (stamp.mtime != idx->stamps[i].mtime ||
+		    stamp.size != idx->stamps[i].size)
+			return (true);
+	}
+	return (false);
+}
+
+void
+init_pnp_cursor(pnp_cursor_t *cur, const pnp_index_t *idx,
+	const devinfo_t *dev)
 {
-	static char *kmod;
-	static const char   **path = NULL;
-	static hints_file_t *hf = NULL;
+	size_t	    lo, hi, mid;
+	pnp_entry_t e;
 
-	if (hf == NULL) {
-		if (path == NULL)
-			path = hints_paths;
+	e.bus = dev->bus;
+	e.key = (uint32_t)dev->vendor << 16 | dev->device;
+	e.seq = 0;
+	for (lo = 0, hi = idx->nentries; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (entrycmp(&idx->entries[mid], &e) < 0)
+			lo = mid + 1;
 		else
-			path++;
-		for (; *path != NULL; path++) {
-			if ((hf = read_hints_file(*path)) != NULL)
-				break;
-		}
-		if (hf == NULL) {
-			path = NULL;
+			hi = mid;
+	}
+	cur->idx  = idx;
+	cur->dev  = dev;
+	cur->pos  = cur->end = lo;
+	cur->wpos = 0;
+	cur->seq  = 0;
+	while (cur->end < idx->nentries &&
+	    idx->entries[cur->end].key == e.key &&
+	    idx->entries[cur->end].bus == e.bus)
+		cur->end++;
+}
+
+/*
+ * With each call, the function returns the next kernel module name
+ * matching the cursor's device, in the order the modules appear in the
+ * hints files. If no further matching modules could be found, NULL is
+ * returned.
+ */
+const char *
+next_pnp_driver(pnp_cursor_t *cur)
+{
+	const pnp_entry_t *e, *w;
+
+	for (;;) {
+		e = cur->pos < cur->end ? &cur->idx->entries[cur->pos] : NULL;
+		w = cur->wpos < cur->idx->nwildcards ?
+		    &cur->idx->wildcards[cur->wpos] : NULL;
+		if (e == NULL && w == NULL)
 			return (NULL);
-		}
+		if (e == NULL || (w != NULL && w->seq < e->seq)) {
+			e = w; cur->wpos++;
+		} else
+			cur->pos++;
+		/* A module is reported only once per PNP info list. */
+		if (e->seq == cur->seq || e->bus != cur->dev->bus)
+			continue;
+		if (!match_pnp_rec(&e->rec, cur->dev))
+			continue;
+		cur->seq = e->seq;
+		return (cur->idx->kmods[e->kmod]);
 	}
-	if ((kmod = next_matching(hf, vendor, device)) != NULL)
-		return (kmod);
-	free_hints_file(hf);
-	hf = NULL;
-	return (find_driver_pnp(vendor, device));
 }
 
 /*
- * Returns the next module name for the given vendor and device ID found
- * in the given hints file.
+ * Compares the fields of a PNP record with the given device. USB interface
+ * fields must all match the same interface.
  */
-static char *
-next_matching(hints_file_t *hf, uint16_t vendor, uint16_t device)
+static bool
+match_pnp_rec(const pnp_rec_t *rec, const devinfo_t *dev)
+{
+	int		i;
+	const uint16_t	*val = rec->val;
+	const iface_t	*iface;
+
+	if ((rec->match & PNP_MATCH(PNP_FIELD_VENDOR)) &&
+	    val[PNP_FIELD_VENDOR] != dev->vendor)
+		return (false);
+	if ((rec->match & PNP_MATCH(PNP_FIELD_DEVICE)) &&
+	    val[PNP_FIELD_DEVICE] != dev->device)
+		return (false);
+	if ((rec->match & PNP_MATCH(PNP_FIELD_SUBVENDOR)) &&
+	    val[PNP_FIELD_SUBVENDOR] != dev->subvendor)
+		return (false);
+	if ((rec->match & PNP_MATCH(PNP_FIELD_SUBDEVICE)) &&
+	    val[PNP_FIELD_SUBDEVICE] != dev->subdevice)
+		return (false);
+	if ((rec->match & PNP_MATCH(PNP_FIELD_CLASS)) &&
+	    val[PNP_FIELD_CLASS] != dev->class)
+		return (false);
+	if ((rec->match & PNP_MATCH(PNP_FIELD_SUBCLASS)) &&
+	    val[PNP_FIELD_SUBCLASS] != dev->subclass)
+		return (false);
+	if (!(rec->match & PNP_MATCH_IFACE))
+		return (true);
+	for (i = 0; i < dev->nifaces; i++) {
+		iface = &dev->iface[i];
+		if ((rec->match & PNP_MATCH(PNP_FIELD_IFCLASS)) &&
+		    val[PNP_FIELD_IFCLASS] != iface->class)
+			continue;
+		if ((rec->match & PNP_MATCH(PNP_FIELD_IFSUBCLASS)) &&
+		    val[PNP_FIELD_IFSUBCLASS] != iface->subclass)
+			continue;
+		if ((rec->match & PNP_MATCH(PNP_FIELD_IFPROTOCOL)) &&
+		    val[PNP_FIELD_IFPROTOCOL] != iface->protocol)
+			continue;
+		return (true);
+	}
+	return (false);
+}
+
+/*
+ * Adds the PNP records of all modules in the given hints file to the
+ * index.
+ */
+static void
+index_hints_file(pnp_index_t *idx, pnp_format_tbl_t *fmts, hints_file_t *hf)
 {
-	int		d, v;
-	char		*str;
-	size_t		slen;
-	static char	kmod[64];
+	int		ret;
+	char		kmod[64];
+	bool		added;
+	pnp_entry_t	e;
 	pnp_info_list_t	pi;
 
-	kmod[0] = '\0';
+	kmod[0] = '\0'; added = true;
 	while (nextrec(hf) != NULL) {
 		if (hf->rectype == MDT_MODULE) {
-			(void)readstr(hf, &slen);
-			str = readstr(hf, &slen);
-			if (slen >= sizeof(kmod)) {
-				warnx("Length of module name >= %lu",
-				    sizeof(kmod));
-				continue;
-			}
-			(void)strlcpy(kmod, str, slen + 1);
-			if (slen > 3 && strncmp(kmod + slen - 3, ".ko", 3) == 0)
-				kmod[slen - 3] = '\0';
+			if (read_kmod_name(hf, kmod, sizeof(kmod)) == 0)
+				added = false;
 			continue;
 		} else if (strcmp(kmod, "kernel") == 0)
 			continue;
 		if (hf->rectype != MDT_PNP_INFO)
 			continue;
-		if (init_pnp_info_list(hf, &pi) == -1)
+		if (init_pnp_info_list(hf, fmts, &pi) == -1)
 			continue;
-		while (read_pnp_record(hf, &pi, &v, &d) != -1) {
-			if (vendor == v && device == d)
-				return (kmod);
+		idx->nlists++;
+		while ((ret = read_pnp_record(hf, &pi, &e.rec)) != -1) {
+			if (ret == 1)
+				continue;
+			if (!added) {
+				if (idx->nkmods >= idx->kmodsz) {
+					idx->kmodsz = idx->kmodsz == 0 ? 256 :
+					    idx->kmodsz * 2;
+					idx->kmods = realloc(idx->kmods,
+					    idx->kmodsz * sizeof(char *));
+					if (idx->kmods == NULL)
+						die("realloc()");
+				}
+				idx->kmods[idx->nkmods] = strdup(kmod);
+				if (idx->kmods[idx->nkmods++] == NULL)
+					die("strdup()");
+				added = true;
+			}
+			e.key  = (uint32_t)e.rec.val[PNP_FIELD_VENDOR] << 16 |
+			    e.rec.val[PNP_FIELD_DEVICE];
+			e.seq  = idx->nlists;
+			e.kmod = idx->nkmods - 1;
+			e.bus  = pi.fmt->bus;
+			if ((e.rec.match & PNP_MATCH(PNP_FIELD_VENDOR)) &&
+			    (e.rec.match & PNP_MATCH(PNP_FIELD_DEVICE))) {
+				add_entry(&idx->entries, &idx->nentries,
+				    &idx->entriesz, &e);
+			} else {
+				add_entry(&idx->wildcards, &idx->nwildcards,
+				    &idx->wildcardsz, &e);
+			}
 		}
 	}
-	return (NULL);
 }
 
+static void
+add_entry(pnp_entry_t **list, size_t *len, size_t *size, const pnp_entry_t *e)
+{
+	if (*len >= *size) {
+		*size = *size == 0 ? 4096 : *size * 2;
+		if ((*list = realloc(*list, *size * sizeof(pnp_entry_t))) ==
+		    NULL)
+			die("realloc()");
+	}
+	(*list)[(*len)++] = *e;
+}
+
+/*
+ * Reads the file name of a module record into kmod, and strips the ".ko"
+ * suffix.
+ */
 static int
-init_pnp_info_list(hints_file_t *hf, pnp_info_list_t *pi)
+read_kmod_name(hints_file_t *hf, char *kmod, size_t size)
 {
-	int    idx;
-	char   *str, *p;
+	char   *str;
 	size_t slen;
 
+	(void)readstr(hf, &slen);
 	str = readstr(hf, &slen);
-	if (slen >= sizeof(pi->bus))
-		ERROR(-1, "Length of bus name >= %lu", sizeof(pi->bus));
-	(void)strlcpy(pi->bus, str, slen + 1);
-	if (strcmp(pi->bus, "pci") != 0 && strcmp(pi->bus, "usb") != 0)
-		return (-1);
-	str = readstr(hf, &slen);
-	if (slen >= sizeof(pi->format))
-		ERROR(-1, "Length of format string >= %lu", sizeof(pi->format));
-	(void)strlcpy(pi->format, str, slen + 1);
-	pi->recsleft = readint(hf);
-	pi->rec      = hf->pos;
-	pi->vendor   = pi->vidx = pi->didx = -1;
-	for (idx = 0, p = pi->format; p != NULL && *p != '\0'; idx++) {
-		if (*p == 'T') {
-			/*
-			 * Check if vendor is defined via the T field.
-			 */
-			p += 2;
-			if (strncmp(p, "vendor=", 7) == 0)
-				pi->vendor = strtol(p + 7, NULL, 16);
-		} else
-			p += 2;
-		if (strncmp(p, "vendor", 6) == 0)
-			pi->vidx = idx;
-		else if (strncmp(p, "device", 6) == 0)
-			pi->didx = idx;
-		if ((p = strchr(p, ';')) != NULL)
-			p++;
-	}
-	if (pi->didx == -1 || (pi->vidx == -1 && pi->vendor == -1))
-		return (-1);
+	if (slen >= size)
+		ERROR(-1, "Length of module name >= %lu", size);
+	(void)strlcpy(kmod, str, slen + 1);
+	if (slen > 3 && strncmp(kmod + slen - 3, ".ko", 3) == 0)
+		kmod[slen - 3] = '\0';
 	return (0);
 }
 
+static int
+lookup_field(const char *name, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(pnp_field_names) / sizeof(pnp_field_names[0]);
+	    i++) {
+		if (strlen(pnp_field_names[i].name) == len &&
+		    strncmp(pnp_field_names[i].name, name, len) == 0)
+			return (pnp_field_names[i].field);
+	}
+	return (-1);
+}
+
 /*
- * Read the next available record from the PNP info list.
+ * Reads the bus name and the format string of a PNP info list, and looks
+ * up the compiled format. Lists of other buses than PCI and USB, and of
+ * USB device mode drivers are skipped.
  */
 static int
-read_pnp_record(hints_file_t *hf, pnp_info_list_t *pi, int *vendor, int *device)
+init_pnp_info_list(hints_file_t *hf, pnp_format_tbl_t *tbl,
+	pnp_info_list_t *pi)
 {
-	int    idx, val;
-	char   *p;
+	int    bus;
+	char   *str;
 	size_t slen;
 
-	if (pi->recsleft-- <= 0)
+	str = readstr(hf, &slen);
+	if (slen == 3 && strncmp(str, "pci", 3) == 0)
+		bus = BUS_TYPE_PCI;
+	else if (slen == 3 && strncmp(str, "usb", 3) == 0)
+		bus = BUS_TYPE_USB;
+	else
 		return (-1);
-	*vendor = pi->vendor;
-	for (idx = 0, p = pi->format; p != NULL && *p != '\0'; idx++) {
+	str = readstr(hf, &slen);
+	pi->fmt	     = get_pnp_format(tbl, bus, str, slen);
+	pi->recsleft = readint(hf);
+
+	return (pi->fmt->unused ? -1 : 0);
+}
+
+/*
+ * Returns the compiled format for the given bus and format string. Each
+ * distinct format is compiled only once.
+ */
+static pnp_format_t *
+get_pnp_format(pnp_format_tbl_t *tbl, int bus, const char *str, size_t len)
+{
+	size_t	     i;
+	uint32_t     h;
+	pnp_format_t *fmt;
+
+	/* FNV-1a */
+	for (i = 0, h = 2166136261U ^ bus; i < len; i++)
+		h = (h ^ (uint8_t)str[i]) * 16777619U;
+	h &= PNP_FORMAT_BUCKETS - 1;
+	for (fmt = tbl->bucket[h]; fmt != NULL; fmt = fmt->next) {
+		if (fmt->bus == bus && fmt->len == len &&
+		    memcmp(fmt->str, str, len) == 0)
+			return (fmt);
+	}
+	if ((fmt = malloc(sizeof(pnp_format_t))) == NULL)
+		die("malloc()");
+	(void)memset(fmt, 0, sizeof(pnp_format_t));
+	if ((fmt->str = malloc(len + 1)) == NULL)
+		die("malloc()");
+	(void)memcpy(fmt->str, str, len);
+	fmt->str[len] = '\0';
+	fmt->len      = len;
+	fmt->bus      = bus;
+	compile_pnp_format(fmt);
+	fmt->next      = tbl->bucket[h];
+	tbl->bucket[h] = fmt;
+
+	return (fmt);
+}
+
+static void
+free_pnp_formats(pnp_format_tbl_t *tbl)
+{
+	int	     i;
+	pnp_format_t *fmt, *next;
+
+	for (i = 0; i < PNP_FORMAT_BUCKETS; i++) {
+		for (fmt = tbl->bucket[i]; fmt != NULL; fmt = next) {
+			next = fmt->next;
+			free(fmt->str);
+			free(fmt);
+		}
+		tbl->bucket[i] = NULL;
+	}
+}
+
+/*
+ * Translates the format string into a list of operations to decode the
+ * fields of a record. Fields without data in the records (T) are
+ * evaluated here, and don't take a bit of the mask.
+ */
+static void
+compile_pnp_format(pnp_format_t *fmt)
+{
+	int	 bit, field;
+	char	 *p, *next, *name;
+	size_t	 len;
+	pnp_op_t *op;
+
+	for (bit = -1, p = fmt->str; p != NULL && *p != '\0'; p = next) {
+		if ((next = strchr(p, ';')) != NULL)
+			next++;
+		name = p[1] == ':' ? p + 2 : p + 1;
+		len  = strcspn(name, ";");
+		if (*p == 'T') {
+			if (parse_t_field(fmt, name, len) == -1)
+				fmt->unused = true;
+			continue;
+		} else if (strchr("GIJLMDZ", *p) == NULL)
+			continue;
+		if (fmt->nops >= PNP_MAX_FIELDS) {
+			warnx("Too many fields in format string '%s'",
+			    fmt->str);
+			fmt->unused = true;
+			return;
+		}
+		op	= &fmt->ops[fmt->nops++];
+		op->bit = bit >= 0 ? bit++ : -1;
 		switch (*p) {
-		case 'G':
+		case 'M':
+			op->op = PNP_OP_MASK;
+			bit = 0;
+			break;
 		case 'I':
 		case 'J':
-		case 'L':
-		case 'M':
-			val = readint(hf);
-			if (idx == pi->didx)
-				*device = val;
-			else if (idx == pi->vidx)
-				*vendor = val;
+			if ((field = lookup_field(name, len)) != -1) {
+				op->op = *p == 'I' ? PNP_OP_INT :
+				    PNP_OP_INT_ANY;
+				op->field = field;
+			} else
+				op->op = PNP_OP_SKIP_INT;
 			break;
-		case 'D':
-		case 'Z':
-			(void)readstr(hf, &slen);
+		case 'G':
+		case 'L':
+			op->op = PNP_OP_SKIP_INT;
 			break;
+		default:
+			op->op = PNP_OP_SKIP_STR;
 		}
-		if ((p = strchr(p, ';')) != NULL)
-			p++;
+	}
+}
+
+/*
+ * T fields define values for all records of a list, e.g. "vendor=0x1234"
+ * or "mode=host". Returns -1 if the list is for USB device mode.
+ */
+static int
+parse_t_field(pnp_format_t *fmt, const char *name, size_t len)
+{
+	int	   field;
+	const char *val;
+
+	if ((val = memchr(name, '=', len)) == NULL)
+		return (0);
+	if (val - name == 4 && strncmp(name, "mode", 4) == 0) {
+		if (strncmp(val + 1, "host", 4) != 0)
+			return (-1);
+	} else if ((field = lookup_field(name, val - name)) != -1) {
+		fmt->defaults.val[field] = strtol(val + 1, NULL, 16);
+		fmt->defaults.match |= PNP_MATCH(field);
 	}
 	return (0);
 }
 
+/*
+ * Read the next available record from the PNP info list. Returns 1 if
+ * the record can't match any device, 0 if it was read successfully, and
+ * -1 if there are no more records.
+ */
+static int
+read_pnp_record(hints_file_t *hf, pnp_info_list_t *pi, pnp_rec_t *rec)
+{
+	int	       mask, val, ret;
+	size_t	       slen;
+	const pnp_op_t *op, *end;
+
+	if (pi->recsleft-- <= 0)
+		return (-1);
+	*rec = pi->fmt->defaults;
+	op   = pi->fmt->ops;
+	end  = op + pi->fmt->nops;
+	for (mask = -1, ret = 0; op < end; op++) {
+		switch (op->op) {
+		case PNP_OP_SKIP_STR:
+			(void)readstr(hf, &slen);
+			continue;
+		case PNP_OP_SKIP_INT:
+			(void)readint(hf);
+			continue;
+		case PNP_OP_MASK:
+			mask = readint(hf);
+			continue;
+		}
+		val = readint(hf);
+		/* Skip fields not selected by the mask. */
+		if (op->bit >= 0 && mask != -1 && !(mask & (1 << op->bit)))
+			continue;
+		if (op->op == PNP_OP_INT_ANY && (val == -1 || val == 0xffff))
+			continue;
+		if (val < 0 || val > 0xffff)
+			ret = 1;
+		rec->val[op->field] = val;
+		rec->match |= PNP_MATCH(op->field);
+	}
+	/* Records without any field to compare are terminators. */
+	if (rec->match == 0)
+		ret = 1;
+	return (ret);
+}
+
 /*
  * FIELD   SIZE
  * reclen  (sizeof(int)) <-- First record 
@@ -251,39 +716,40 @@ nextrec(hints_file_t *hf)
 }
 
 static hints_file_t *
-read_hints_file(const char *path)
+map_hints_file(const char *path)
 {
 	int	     fd, version;
 	struct stat  sb;
 	hints_file_t *hf;
 
-	if ((hf = malloc(sizeof(hints_file_t))) == NULL)
-		die("malloc()");
-	if (stat(path, &sb) == -1) {
-		if (errno != ENOENT)
-			die("stat(%s)", path);
-		return (NULL);
-	}
 	if ((fd = open(path, O_RDONLY, 0)) == -1) {
 		if (errno != ENOENT)
 			die("open(%s)", path);
 		return (NULL);
 	}
-	if ((hf->buf = malloc(sb.st_size)) == NULL)
+	if (fstat(fd, &sb) == -1)
+		die("fstat(%s)", path);
+	if ((size_t)sb.st_size < sizeof(int)) {
+		(void)close(fd);
+		warnx("%s: File too short", path);
+		return (NULL);
+	}
+	if ((hf = malloc(sizeof(hints_file_t))) == NULL)
 		die("malloc()");
-	if (read(fd, hf->buf, sb.st_size) == -1)
-		die("read(%s)", path);
+	hf->size = sb.st_size;
+	hf->buf = mmap(NULL, hf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (hf->buf == MAP_FAILED)
+		die("mmap(%s)", path);
 	(void)close(fd);
 	hf->pos = hf->buf;
 	version = readint(hf);
 	if (version != LINKER_HINTS_VERSION) {
 		warnx("Version mismatch (%d != %d) of file %s.\n",
 		      version, LINKER_HINTS_VERSION, path);
-		free_hints_file(hf);
+		unmap_hints_file(hf);
 		return (NULL);
 	}
-	hf->rec  = hf->pos;
-	hf->size = sb.st_size;
+	hf->rec = hf->pos;
 
 	return (hf);
 }
@@ -309,8 +775,37 @@ readstr(hints_file_t *hf, size_t *slen)
 }
 
 static void
-free_hints_file(hints_file_t *hf)
+unmap_hints_file(hints_file_t *hf)
 {
-	free(hf->buf);
+	(void)munmap(hf->buf, hf->size);
 	free(hf);
 }
+
+static void
+get_stamp(const char *path, hints_stamp_t *stamp)
+{
+	struct stat sb;
+
+	if (stat(path, &sb) == -1) {
+		stamp->mtime = stamp->size = -1;
+		return;
+	}
+	stamp->mtime = sb.st_mtime;
+	stamp->size  = sb.st_size;
+}
+
+/*
+ * Sorts by bus and key, and by position in the hints files if both are
+ * equal.
+ */
+static int
+entrycmp(const void *a, const void *b)
+{
+	const pnp_entry_t *e1 = a, *e2 = b;
+
+	if (e1->bus != e2->bus)
+		return (e1->bus < e2->bus ? -1 : 1);
+	if (e1->key != e2->key)
+		return (e1->key < e2->key ? -1 : 1);
+	return (e1->seq < e2->seq ? -1 : e1->seq > e2->seq);
+}
@@ -26,6 +26,33 @@
 #define _HINTS_H_
 
 #include <sys/types.h>
+#include <stdbool.h>
 
-extern char *find_driver_pnp(uint16_t, uint16_t);
+#include "device.h"
+
+/*
+ * In-memory index of the PNP records from the linker.hints files.
+ */
+typedef struct pnp_index_s pnp_index_t;
+
+/*
+ * Cursor to iterate over the kernel modules from the PNP index matching
+ * a device.
+ */
+typedef struct pnp_cursor_s {
+	const pnp_index_t *idx;
+	const devinfo_t	  *dev;
+	size_t		  pos;		/* Current position in range */
+	size_t		  end;		/* End of matching index range */
+	size_t		  wpos;		/* Current position in wildcards */
+	uint32_t	  seq;		/* PNP info list of last match */
+} pnp_cursor_t;
+
+extern const char *hints_paths[];
+extern bool	  is_pnp_index_stale(const pnp_index_t *);
+extern void	  init_pnp_cursor(pnp_cursor_t *, const pnp_index_t *,
+			const devinfo_t *);
+extern void	  free_pnp_index(pnp_index_t *);
+extern const char *next_pnp_driver(pnp_cursor_t *);
+extern pnp_index_t *load_pnp_index(void);
 #endif
@@ -0,0 +1,380 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "log.h"
+#include "iddb.h"
+
+/*
+ * Index entry of a vendor block. A vendor block consists of the vendor
+ * line, its device lines (one tab), and their subsystem lines (two tabs).
+ */
+typedef struct id_vendor_s {
+	uint16_t id;
+	bool	 sorted;	/* Device lines are sorted by ID */
+	uint32_t line;		/* Offset of the vendor line */
+	uint32_t start;		/* Offset of the line following it */
+	uint32_t end;		/* Offset of the end of the block */
+} id_vendor_t;
+
+struct id_db_s {
+	char	    *buf;	/* Mapped file */
+	size_t	    size;
+	id_vendor_t *vendors;	/* Vendor index sorted by ID */
+	size_t	    nvendors;
+};
+
+static int	  vendorcmp(const void *, const void *);
+static bool	  parse_hex4(const char *, const char *, uint16_t *);
+static bool	  is_device_line(const id_db_t *, size_t, uint16_t *);
+static void	  build_vendor_index(id_db_t *);
+static void	  append_name(const id_db_t *, size_t, size_t, char *, size_t);
+static size_t	  next_line(const id_db_t *, size_t);
+static size_t	  find_device(const id_db_t *, const id_vendor_t *, uint16_t);
+static size_t	  find_subsystem(const id_db_t *, const id_vendor_t *, size_t,
+		      uint16_t, uint16_t);
+static const id_vendor_t *find_vendor(const id_db_t *, uint16_t);
+
+/*
+ * Maps the ID database at the given path, and creates an index of its
+ * vendor blocks. Returns NULL if the file could not be opened or mapped.
+ */
+id_db_t *
+open_id_db(const char *path)
+{
+	int	    fd;
+	struct stat sb;
+	id_db_t	    *db;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (NULL);
+	if (fstat(fd, &sb) == -1) {
+		(void)close(fd);
+		return (NULL);
+	}
+	if ((uintmax_t)sb.st_size > UINT32_MAX) {
+		(void)close(fd);
+		errno = EFBIG;
+		return (NULL);
+	}
+	if ((db = malloc(sizeof(id_db_t))) == NULL)
+		die("malloc()");
+	(void)memset(db, 0, sizeof(id_db_t));
+	db->size = sb.st_size;
+	if (db->size > 0) {
+		db->buf = mmap(NULL, db->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (db->buf == MAP_FAILED) {
+			(void)close(fd);
+			free(db);
+			return (NULL);
+		}
+	}
+	(void)close(fd);
+	build_vendor_index(db);
+
+	return (db);
+}
+
+void
+close_id_db(id_db_t *db)
+{
+	if (db == NULL)
+		return;
+	if (db->buf != NULL)
+		(void)munmap(db->buf, db->size);
+	free(db->vendors);
+	free(db);
+}
+
+/*
+ * Writes "<vendor name> <device name>[ <subsystem name>]" to buf, and
+ * returns buf. Returns NULL if there is no entry for the vendor and
+ * device ID.
+ */
+char *
+lookup_id_db(const id_db_t *db, uint16_t vendor, uint16_t device,
+	uint16_t subvendor, uint16_t subdevice, char *buf, size_t size)
+{
+	size_t		  dev, sub;
+	const id_vendor_t *v;
+
+	if ((v = find_vendor(db, vendor)) == NULL)
+		return (NULL);
+	if ((dev = find_device(db, v, device)) == v->end)
+		return (NULL);
+	buf[0] = '\0';
+	append_name(db, v->line, 1, buf, size);
+	append_name(db, dev, 1, buf, size);
+	sub = find_subsystem(db, v, dev, subvendor, subdevice);
+	if (sub != v->end)
+		append_name(db, sub, 2, buf, size);
+	return (buf);
+}
+
+/*
+ * Scans the file once, and records the position of each vendor block.
+ * Lines at column 0 which don't start with a vendor ID (e.g. the device
+ * class lists at the end of pci.ids) end the current block, and are not
+ * indexed.
+ */
+static void
+build_vendor_index(id_db_t *db)
+{
+	size_t	    pos, cap;
+	int32_t	    prev;
+	uint16_t    id;
+	id_vendor_t *v;
+
+	cap = 0; v = NULL; prev = -1;
+	for (pos = 0; pos < db->size; pos = next_line(db, pos)) {
+		if (db->buf[pos] == '#' || db->buf[pos] == '\n')
+			continue;
+		if (db->buf[pos] == '\t') {
+			if (v == NULL || !is_device_line(db, pos, &id))
+				continue;
+			if (id <= prev)
+				v->sorted = false;
+			prev = id;
+			continue;
+		}
+		if (v != NULL)
+			v->end = pos;
+		v = NULL;
+		if (!parse_hex4(db->buf + pos, db->buf + db->size, &id))
+			continue;
+		if (db->nvendors >= cap) {
+			cap = cap == 0 ? 1024 : cap * 2;
+			db->vendors = realloc(db->vendors,
+			    cap * sizeof(id_vendor_t));
+			if (db->vendors == NULL)
+				die("realloc()");
+		}
+		v = &db->vendors[db->nvendors++];
+		v->id	  = id;
+		v->sorted = true;
+		v->line	  = pos;
+		v->start  = v->end = next_line(db, pos);
+		prev	  = -1;
+	}
+	if (v != NULL)
+		v->end = db->size;
+	qsort(db->vendors, db->nvendors, sizeof(id_vendor_t), vendorcmp);
+}
+
+static const id_vendor_t *
+find_vendor(const id_db_t *db, uint16_t id)
+{
+	size_t lo, hi, mid;
+
+	for (lo = 0, hi = db->nvendors; lo < hi;) {
+		mid = lo + (hi - lo) / 2;
+		if (db->vendors[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < db->nvendors && db->vendors[lo].id == id)
+		return (&db->vendors[lo]);
+	return (NULL);
+}
+
+/*
+ * Returns the offset of the device line with the given ID in the vendor
+ * block, or v->end if there is none. If the device lines are sorted, the
+ * block is bisected at byte level, otherwise it is scanned linearly.
+ */
+static size_t
+find_device(const id_db_t *db, const id_vendor_t *v, uint16_t id)
+{
+	size_t	 lo, hi, mid, pos;
+	uint16_t val;
+
+	if (!v->sorted) {
+		for (pos = v->start; pos < v->end; pos = next_line(db, pos)) {
+			if (is_device_line(db, pos, &val) && val == id)
+				return (pos);
+		}
+		return (v->end);
+	}
+	for (lo = v->start, hi = v->end; lo < hi;) {
+		/* Go to the start of the line containing the middle. */
+		for (mid = lo + (hi - lo) / 2; mid > lo &&
+		    db->buf[mid - 1] != '\n'; mid--)
+			;
+		/* Go to the first device line at or after mid. */
+		for (pos = mid; pos < hi && !is_device_line(db, pos, &val);)
+			pos = next_line(db, pos);
+		if (pos >= hi) {
+			/* No device lines in [mid, hi) */
+			if (mid == lo)
+				break;
+			hi = mid;
+			continue;
+		}
+		if (val == id)
+			return (pos);
+		if (val < id)
+			lo = next_line(db, pos);
+		else
+			hi = pos;
+	}
+	return (v->end);
+}
+
+/*
+ * Returns the offset of the first subsystem line of the given device line
+ * matching the subvendor and subdevice ID, or v->end if there is none.
+ */
+static size_t
+find_subsystem(const id_db_t *db, const id_vendor_t *v, size_t dev,
+	uint16_t subvendor, uint16_t subdevice)
+{
+	size_t	   pos;
+	uint16_t   sv, sd;
+	const char *p, *end;
+
+	end = db->buf + v->end;
+	for (pos = next_line(db, dev); pos < v->end; pos = next_line(db, pos)) {
+		p = db->buf + pos;
+		if (*p == '#' || *p == '\n')
+			continue;
+		if (end - p < 2 || p[0] != '\t' || p[1] != '\t')
+			break;
+		if (!parse_hex4(p + 2, end, &sv) ||
+		    !parse_hex4(p + 7, end, &sd))
+			continue;
+		if (sv == subvendor && sd == subdevice)
+			return (pos);
+	}
+	return (v->end);
+}
+
+/*
+ * Appends the name of the line at pos to buf. The name follows nids
+ * IDs, and ends at the end of the line or at a '#'.
+ */
+static void
+append_name(const id_db_t *db, size_t pos, size_t nids, char *buf,
+	size_t size)
+{
+	size_t	   len, buflen;
+	const char *p, *end;
+
+	end = db->buf + db->size;
+	for (p = db->buf + pos; p < end && *p == '\t'; p++)
+		;
+	for (; nids > 0; nids--) {
+		for (; p < end && *p != ' ' && *p != '\t' && *p != '\n'; p++)
+			;
+		for (; p < end && (*p == ' ' || *p == '\t'); p++)
+			;
+	}
+	for (len = 0; p + len < end && p[len] != '\n' && p[len] != '#'; len++)
+		;
+	buflen = strlen(buf);
+	if (buflen > 0 && buflen + 1 < size) {
+		buf[buflen++] = ' ';
+		buf[buflen] = '\0';
+	}
+	if (buflen + len >= size)
+		len = size > buflen ? size - buflen - 1 : 0;
+	(void)memcpy(buf + buflen, p, len);
+	buf[buflen + len] = '\0';
+}
+
+/*
+ * Checks if the line at pos is a device line, i.e., starts with a single
+ * tab followed by an ID.
+ */
+static bool
+is_device_line(const id_db_t *db, size_t pos, uint16_t *id)
+{
+	const char *p, *end;
+
+	p = db->buf + pos; end = db->buf + db->size;
+	if (end - p < 2 || p[0] != '\t' || p[1] == '\t')
+		return (false);
+	return (parse_hex4(p + 1, end, id));
+}
+
+/*
+ * Parses an ID consisting of four hex digits followed by a space or tab.
+ */
+static bool
+parse_hex4(const char *p, const char *end, uint16_t *id)
+{
+	int i, d;
+
+	if (end - p < 5 || (p[4] != ' ' && p[4] != '\t'))
+		return (false);
+	for (i = 0, *id = 0; i < 4; i++) {
+		if (p[i] >= '0' && p[i] <= '9')
+			d = p[i] - '0';
+		else if (p[i] >= 'a' && p[i] <= 'f')
+			d = p[i] - 'a' + 10;
+		else if (p[i] >= 'A' && p[i] <= 'F')
+			d = p[i] - 'A' + 10;
+		else
+			return (false);
+		*id = *id << 4 | d;
+	}
+	return (true);
+}
+
+/*
+ * Returns the offset of the line following the line at pos.
+ */
+static size_t
+next_line(const id_db_t *db, size_t pos)
+{
+	const char *p;
+
+	p = memchr(db->buf + pos, '\n', db->size - pos);
+	return (p == NULL ? db->size : (size_t)(p - db->buf) + 1);
+}
+
+/*
+ * Sorts by ID, and by position if IDs are equal, so the first block of a
+ * vendor in the file is found first.
+ */
+static int
+vendorcmp(const void *a, const void *b)
+{
+	const id_vendor_t *v1 = a, *v2 = b;
+
+	if (v1->id != v2->id)
+		return (v1->id < v2->id ? -1 : 1);
+	return (v1->line < v2->line ? -1 : v1->line > v2->line);
+}
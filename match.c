@@ -0,0 +1,92 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "match.h"
+
+void
+begin_match(match_ctx_t *ctx, const drivers_db_t *db, const pnp_index_t *pnp,
+	const devinfo_t *dev)
+{
+	(void)memset(ctx, 0, sizeof(match_ctx_t));
+	ctx->dev   = dev;
+	ctx->state = MATCH_STATE_DB;
+	init_db_cursor(db, dev, &ctx->dbcur);
+	init_pnp_cursor(&ctx->pnpcur, pnp, dev);
+}
+
+/*
+ * Returns the next driver for the context's device, or NULL if there are
+ * no more matching drivers. The returned string is valid until the next
+ * call of next_match() or end_match().
+ */
+const char *
+next_match(match_ctx_t *ctx)
+{
+	const char *driver;
+
+	switch (ctx->state) {
+	case MATCH_STATE_DB:
+		if ((driver = next_db_driver(&ctx->dbcur)) != NULL)
+			return (driver);
+		ctx->state = MATCH_STATE_PNP;
+		/* FALLTHROUGH */
+	case MATCH_STATE_PNP:
+		if ((driver = next_pnp_driver(&ctx->pnpcur)) != NULL)
+			return (driver);
+		ctx->state = MATCH_STATE_DONE;
+	}
+	return (NULL);
+}
+
+void
+end_match(match_ctx_t *ctx)
+{
+	ctx->state = MATCH_STATE_DONE;
+}
+
+/*
+ * Matches all devices of the NULL-terminated list, and adds the drivers to
+ * each device's driver list. The resulting order of drivers per device is
+ * the same as returned by next_match().
+ */
+void
+match_devlist(const drivers_db_t *db, const pnp_index_t *pnp, devinfo_t **devs)
+{
+	const char   *driver;
+	db_cursor_t  dbcur;
+	pnp_cursor_t pnpcur;
+
+	for (; devs != NULL && *devs != NULL; devs++) {
+		init_db_cursor(db, *devs, &dbcur);
+		while ((driver = next_db_driver(&dbcur)) != NULL)
+			add_driver(*devs, driver);
+		init_pnp_cursor(&pnpcur, pnp, *devs);
+		while ((driver = next_pnp_driver(&pnpcur)) != NULL)
+			add_driver(*devs, driver);
+	}
+}
@@ -0,0 +1,55 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MATCH_H_
+#define _MATCH_H_
+#include <sys/types.h>
+
+#include "device.h"
+#include "driversdb.h"
+#include "hints.h"
+
+/*
+ * Context to iterate over all drivers matching a device. Drivers from the
+ * drivers DB are returned first, followed by the kernel modules from the
+ * PNP index. All iteration state lives in the context object, so
+ * several matches can run at the same time.
+ */
+typedef struct match_ctx_s {
+	int		   state;
+#define MATCH_STATE_DB	   1
+#define MATCH_STATE_PNP	   2
+#define MATCH_STATE_DONE   3
+	const devinfo_t	   *dev;
+	db_cursor_t	   dbcur;
+	pnp_cursor_t	   pnpcur;
+} match_ctx_t;
+
+extern void	  begin_match(match_ctx_t *, const drivers_db_t *,
+			const pnp_index_t *, const devinfo_t *);
+extern void	  end_match(match_ctx_t *);
+extern const char *next_match(match_ctx_t *);
+extern void	  match_devlist(const drivers_db_t *, const pnp_index_t *,
+			devinfo_t **);
+#endif
@@ -0,0 +1,243 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "msgqueue.h"
+
+/*
+ * head and tail count the popped and pushed messages. Only the consumer
+ * changes head, and only the producer changes tail and hwm. lock and
+ * space are only used while the producer waits for a free slot.
+ */
+struct msg_queue_s {
+	int		 fd[2];		/* Wakeup pipe */
+	char		 **slots;
+	size_t		 size;		/* # of slots, a power of two */
+	atomic_size_t	 head;
+	atomic_size_t	 tail;
+	atomic_size_t	 hwm;		/* High-water mark */
+	atomic_bool	 woken;		/* Wakeup is pending */
+	atomic_bool	 waiting;	/* Producer waits for a free slot */
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 space;
+};
+
+/*
+ * Creates a queue of at least the given number of slots.
+ */
+msg_queue_t *
+create_msg_queue(size_t size)
+{
+	int	    i;
+	msg_queue_t *q;
+
+	if ((q = malloc(sizeof(msg_queue_t))) == NULL)
+		return (NULL);
+	for (q->size = 1; q->size < size; q->size <<= 1)
+		;
+	if ((q->slots = malloc(q->size * sizeof(char *))) == NULL) {
+		free(q);
+		return (NULL);
+	}
+	if (pipe(q->fd) == -1) {
+		free(q->slots);
+		free(q);
+		return (NULL);
+	}
+	if ((errno = pthread_mutex_init(&q->lock, NULL)) != 0 ||
+	    (errno = pthread_cond_init(&q->space, NULL)) != 0) {
+		(void)close(q->fd[0]);
+		(void)close(q->fd[1]);
+		free(q->slots);
+		free(q);
+		return (NULL);
+	}
+	for (i = 0; i < 2; i++) {
+		(void)fcntl(q->fd[i], F_SETFL,
+		    fcntl(q->fd[i], F_GETFL) | O_NONBLOCK);
+		(void)fcntl(q->fd[i], F_SETFD, FD_CLOEXEC);
+	}
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->hwm, 0);
+	atomic_init(&q->woken, false);
+	atomic_init(&q->waiting, false);
+
+	return (q);
+}
+
+/*
+ * Frees the queue and the messages still in it.
+ */
+void
+free_msg_queue(msg_queue_t *q)
+{
+	char *msg;
+
+	if (q == NULL)
+		return;
+	while ((msg = pop_msg(q)) != NULL)
+		free(msg);
+	(void)close(q->fd[0]);
+	(void)close(q->fd[1]);
+	(void)pthread_mutex_destroy(&q->lock);
+	(void)pthread_cond_destroy(&q->space);
+	free(q->slots);
+	free(q);
+}
+
+int
+msg_queue_fd(const msg_queue_t *q)
+{
+	return (q->fd[0]);
+}
+
+/*
+ * Appends the given message to the queue. Returns false if the queue is
+ * full. Called by the producer.
+ */
+bool
+push_msg(msg_queue_t *q, char *msg)
+{
+	size_t head, tail;
+
+	tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&q->head, memory_order_acquire);
+	if (tail - head == q->size)
+		return (false);
+	q->slots[tail & (q->size - 1)] = msg;
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+	if (tail + 1 - head > atomic_load_explicit(&q->hwm,
+	    memory_order_relaxed)) {
+		atomic_store_explicit(&q->hwm, tail + 1 - head,
+		    memory_order_relaxed);
+	}
+	return (true);
+}
+
+/*
+ * Like push_msg(), but if the queue is full, wakes the consumer, and
+ * blocks until it made room. Called by the producer.
+ */
+void
+push_msg_wait(msg_queue_t *q, char *msg)
+{
+	if (push_msg(q, msg))
+		return;
+	(void)pthread_mutex_lock(&q->lock);
+	atomic_store(&q->waiting, true);
+	/* Pairs with the fence in pop_msg(). */
+	atomic_thread_fence(memory_order_seq_cst);
+	while (!push_msg(q, msg)) {
+		wake_msg_queue(q);
+		(void)pthread_cond_wait(&q->space, &q->lock);
+	}
+	atomic_store(&q->waiting, false);
+	(void)pthread_mutex_unlock(&q->lock);
+}
+
+/*
+ * Removes the oldest message from the queue, and returns it, or NULL if
+ * the queue is empty. Called by the consumer. If the producer waits for
+ * a free slot, it is signaled.
+ */
+char *
+pop_msg(msg_queue_t *q)
+{
+	char   *msg;
+	size_t head, tail;
+
+	head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	if (head == tail)
+		return (NULL);
+	msg = q->slots[head & (q->size - 1)];
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+	/*
+	 * Either the producer sees the new head, or we see that it's
+	 * waiting. It holds the lock until it waits on the condition.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q->waiting, memory_order_relaxed)) {
+		(void)pthread_mutex_lock(&q->lock);
+		(void)pthread_cond_signal(&q->space);
+		(void)pthread_mutex_unlock(&q->lock);
+	}
+	return (msg);
+}
+
+/*
+ * Makes the queue's fd readable, unless a wakeup is already pending.
+ * Called by the producer after pushing messages.
+ */
+void
+wake_msg_queue(msg_queue_t *q)
+{
+	if (atomic_exchange(&q->woken, true))
+		return;
+	while (write(q->fd[1], "", 1) == -1 && errno == EINTR)
+		;
+}
+
+/*
+ * Clears a pending wakeup. Called by the consumer before popping the
+ * messages, so no wakeup for messages pushed meanwhile gets lost.
+ */
+void
+ack_msg_queue(msg_queue_t *q)
+{
+	char c;
+
+	while (read(q->fd[0], &c, 1) == 1)
+		;
+	atomic_store(&q->woken, false);
+}
+
+size_t
+msg_queue_depth(msg_queue_t *q)
+{
+	size_t head;
+
+	head = atomic_load(&q->head);
+	return (atomic_load(&q->tail) - head);
+}
+
+size_t
+msg_queue_hwm(msg_queue_t *q)
+{
+	return (atomic_load(&q->hwm));
+}
+
+size_t
+msg_queue_size(const msg_queue_t *q)
+{
+	return (q->size);
+}
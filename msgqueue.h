@@ -0,0 +1,48 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _MSGQUEUE_H_
+#define _MSGQUEUE_H_
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Lock-free queue of strings passed from a single producer thread to a
+ * single consumer thread. The producer wakes the consumer via a file
+ * descriptor, which is readable while a wakeup is pending.
+ */
+typedef struct msg_queue_s msg_queue_t;
+
+extern int	   msg_queue_fd(const msg_queue_t *);
+extern bool	   push_msg(msg_queue_t *, char *);
+extern void	   push_msg_wait(msg_queue_t *, char *);
+extern char	   *pop_msg(msg_queue_t *);
+extern void	   wake_msg_queue(msg_queue_t *);
+extern void	   ack_msg_queue(msg_queue_t *);
+extern void	   free_msg_queue(msg_queue_t *);
+extern size_t	   msg_queue_depth(msg_queue_t *);
+extern size_t	   msg_queue_hwm(msg_queue_t *);
+extern size_t	   msg_queue_size(const msg_queue_t *);
+extern msg_queue_t *create_msg_queue(size_t);
+#endif
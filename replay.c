@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include "log.h"
+#include "device.h"
+#include "replay.h"
+
+enum {
+	KEY_VENDOR, KEY_PRODUCT, KEY_SUBVENDOR, KEY_SUBDEVICE, KEY_CLASS,
+	KEY_SUBCLASS, KEY_REVISION, KEY_IFCLASS, KEY_IFSUBCLASS, KEY_PROTOCOL,
+	NKEYS
+};
+
+static const char *keys[NKEYS] = {
+	"vendor", "product", "subvendor", "subdevice", "class", "subclass",
+	"revision", "ifclass", "ifsubclass", "protocol"
+};
+
+/*
+ * Device or interface record of a snapshot line.
+ */
+typedef struct snapshot_rec_s {
+	int  bus;
+	long val[NKEYS];		/* -1 if not set */
+	char ugen[32];			/* Empty if not set */
+	char sel[32];			/* PCI selector, empty if not set */
+} snapshot_rec_t;
+
+static int read_snapshot(devlist_t *, const char *, int);
+static int parse_snapshot_line(char *, snapshot_rec_t *);
+
+int
+replay_get_pci_devs(devlist_t *devlist, const char *path)
+{
+	return (read_snapshot(devlist, path, BUS_TYPE_PCI));
+}
+
+int
+replay_get_usb_devs(devlist_t *devlist, const char *path)
+{
+	return (read_snapshot(devlist, path, BUS_TYPE_USB));
+}
+
+/*
+ * Adds the devices of the given bus from the snapshot to the list. Each
+ * line of the snapshot describes a device in the format of the -l or -i
+ * output:
+ *
+ *	vendor=8086 product=2922 class=01 subclass=06 bus=PCI descr: ahci
+ *
+ * The key=value pairs up to the first other word are read, and the rest
+ * of the line is ignored. The optional keys subvendor, subdevice, revision,
+ * ugen and sel (the PCI selector) may be added. Lines with an "ifclass" key
+ * add an interface to the preceding USB device. Consecutive lines of the
+ * same device, as printed by -l for each of its drivers, are merged. The
+ * -i output has a line per device with its ugen name or selector, so
+ * identical devices are kept apart. Empty lines, and lines starting with
+ * '#' are ignored.
+ */
+static int
+read_snapshot(devlist_t *devlist, const char *path, int bus)
+{
+	int	       i, n, lineno;
+	bool	       merged;
+	FILE	       *fp;
+	char	       ln[_POSIX2_LINE_MAX], loc[32];
+	devinfo_t      *dev;
+	snapshot_rec_t rec, prev;
+
+	if (path == NULL)
+		diex("The replay backend requires a snapshot file");
+	if ((fp = fopen(path, "r")) == NULL)
+		die("fopen(%s)", path);
+	(void)memset(&prev, 0, sizeof(prev));
+	dev = NULL; merged = false;
+	for (n = 0, lineno = 1; fgets(ln, sizeof(ln), fp) != NULL; lineno++) {
+		ln[strcspn(ln, "\n")] = '\0';
+		if (ln[0] == '\0' || ln[0] == '#')
+			continue;
+		if (parse_snapshot_line(ln, &rec) == -1) {
+			logprintx("%s:%d: Invalid line ignored", path, lineno);
+			continue;
+		}
+		if (rec.val[KEY_IFCLASS] != -1) {
+			if (dev != NULL && !merged) {
+				add_iface(dev, rec.val[KEY_IFCLASS],
+				    MAX(rec.val[KEY_IFSUBCLASS], 0),
+				    MAX(rec.val[KEY_PROTOCOL], 0));
+			}
+			continue;
+		}
+		if (rec.bus == prev.bus && strcmp(rec.ugen, prev.ugen) == 0 &&
+		    strcmp(rec.sel, prev.sel) == 0 &&
+		    memcmp(rec.val, prev.val, sizeof(rec.val)) == 0) {
+			merged = true;
+			continue;
+		}
+		prev = rec; merged = false; dev = NULL;
+		if (rec.bus != bus)
+			continue;
+		for (i = 0; i < NKEYS; i++) {
+			if (rec.val[i] == -1)
+				rec.val[i] = 0;
+		}
+		if (bus == BUS_TYPE_USB) {
+			/* Make up a unique ugen name if there is none. */
+			if (rec.ugen[0] == '\0') {
+				(void)snprintf(loc, sizeof(loc), "ugen0.%d",
+				    lineno);
+			} else
+				(void)strlcpy(loc, rec.ugen, sizeof(loc));
+			dev = add_usb_dev(devlist, loc, NULL,
+			    rec.val[KEY_VENDOR], rec.val[KEY_PRODUCT],
+			    rec.val[KEY_CLASS], rec.val[KEY_SUBCLASS]);
+			if (dev == NULL)
+				continue;
+		} else {
+			/* Likewise for the selector. */
+			if (rec.sel[0] == '\0') {
+				(void)snprintf(loc, sizeof(loc), "pci0:0:0:%d",
+				    lineno);
+			} else
+				(void)strlcpy(loc, rec.sel, sizeof(loc));
+			if ((dev = add_pci_dev(devlist, loc)) == NULL)
+				continue;
+			dev->vendor   = rec.val[KEY_VENDOR];
+			dev->device   = rec.val[KEY_PRODUCT];
+			dev->class    = rec.val[KEY_CLASS];
+			dev->subclass = rec.val[KEY_SUBCLASS];
+		}
+		dev->subvendor = rec.val[KEY_SUBVENDOR];
+		dev->subdevice = rec.val[KEY_SUBDEVICE];
+		dev->revision  = rec.val[KEY_REVISION];
+		n++;
+	}
+	if (ferror(fp))
+		die("fgets(%s)", path);
+	(void)fclose(fp);
+
+	return (n);
+}
+
+/*
+ * Parses the key=value pairs at the beginning of the given snapshot line.
+ * Returns -1 if the bus, vendor or product is missing.
+ */
+static int
+parse_snapshot_line(char *ln, snapshot_rec_t *rec)
+{
+	int  i;
+	char *p, *q;
+
+	(void)memset(rec, 0, sizeof(snapshot_rec_t));
+	for (i = 0; i < NKEYS; i++)
+		rec->val[i] = -1;
+	for (p = ln; (p = strtok(p, " \t")) != NULL; p = NULL) {
+		if ((q = strchr(p, '=')) == NULL)
+			break;
+		*q++ = '\0';
+		if (strcmp(p, "bus") == 0) {
+			if (strcmp(q, "PCI") == 0)
+				rec->bus = BUS_TYPE_PCI;
+			else if (strcmp(q, "USB") == 0)
+				rec->bus = BUS_TYPE_USB;
+			continue;
+		} else if (strcmp(p, "ugen") == 0) {
+			(void)strlcpy(rec->ugen, q, sizeof(rec->ugen));
+			continue;
+		} else if (strcmp(p, "sel") == 0) {
+			(void)strlcpy(rec->sel, q, sizeof(rec->sel));
+			continue;
+		}
+		for (i = 0; i < NKEYS && strcmp(p, keys[i]) != 0; i++)
+			;
+		if (i < NKEYS)
+			rec->val[i] = strtol(q, NULL, 16) & 0xffff;
+	}
+	if (rec->bus == 0 || rec->val[KEY_VENDOR] == -1 ||
+	    rec->val[KEY_PRODUCT] == -1)
+		return (-1);
+	return (0);
+}
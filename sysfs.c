@@ -0,0 +1,231 @@
+/*-
+ * Copyright (c) 2026 Marcel Kaiser. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/param.h>
+#include <sys/types.h>
+
+#include "log.h"
+#include "device.h"
+#include "sysfs.h"
+
+#define PCI_DEVS_DIR "bus/pci/devices"
+#define USB_DEVS_DIR "bus/usb/devices"
+
+static int  read_attr(const char *, const char *, const char *, char *,
+		size_t);
+static int  scan_devs_dir(const char *, struct dirent ***);
+static long read_int_attr(const char *, const char *, const char *, int);
+static void add_usb_ifaces(devinfo_t *, const char *, struct dirent **, int,
+		const char *);
+
+/*
+ * Adds the PCI devices from <root>/bus/pci/devices to the list, which are
+ * not in it yet.
+ */
+int
+sysfs_get_pci_devs(devlist_t *devlist, const char *root)
+{
+	int	       i, n, ndevs;
+	char	       dir[PATH_MAX], sel[32];
+	long	       vendor, device, class;
+	unsigned int   dom, bus, slot, func;
+	const char     *name;
+	devinfo_t      *dip;
+	struct dirent **ents;
+
+	(void)snprintf(dir, sizeof(dir), "%s/%s", root, PCI_DEVS_DIR);
+	n = scan_devs_dir(dir, &ents);
+	for (i = ndevs = 0; i < n; i++) {
+		name   = ents[i]->d_name;
+		vendor = read_int_attr(dir, name, "vendor", 16);
+		device = read_int_attr(dir, name, "device", 16);
+		if (vendor == -1 || device == -1)
+			continue;
+		/* Entries are named <domain>:<bus>:<slot>.<function> */
+		if (sscanf(name, "%x:%x:%x.%x", &dom, &bus, &slot,
+		    &func) != 4)
+			continue;
+		(void)snprintf(sel, sizeof(sel), "pci%u:%u:%u:%u", dom, bus,
+		    slot, func);
+		if ((dip = add_pci_dev(devlist, sel)) == NULL)
+			continue;
+		dip->vendor    = vendor;
+		dip->device    = device;
+		dip->subvendor = MAX(read_int_attr(dir, name,
+		    "subsystem_vendor", 16), 0);
+		dip->subdevice = MAX(read_int_attr(dir, name,
+		    "subsystem_device", 16), 0);
+		dip->revision  = MAX(read_int_attr(dir, name, "revision", 16), 0);
+		/* The class attribute is 0xCCSSPP */
+		if ((class = read_int_attr(dir, name, "class", 16)) != -1) {
+			dip->class    = (class >> 16) & 0xff;
+			dip->subclass = (class >> 8) & 0xff;
+		}
+		ndevs++;
+	}
+	for (i = 0; i < n; i++)
+		free(ents[i]);
+	free(ents);
+
+	return (ndevs);
+}
+
+/*
+ * Adds the USB devices from <root>/bus/usb/devices to the list. Entries of
+ * the form <device>:<config>.<interface> are the interfaces of <device>.
+ * The ugen name of a device is built from its bus and device number.
+ */
+int
+sysfs_get_usb_devs(devlist_t *devlist, const char *root)
+{
+	int	       i, n, ndevs;
+	char	       dir[PATH_MAX], ugen[32], serial[256];
+	long	       vendor, product, busnum, devnum;
+	const char     *name;
+	devinfo_t      *dip;
+	struct dirent **ents;
+
+	(void)snprintf(dir, sizeof(dir), "%s/%s", root, USB_DEVS_DIR);
+	n = scan_devs_dir(dir, &ents);
+	for (i = ndevs = 0; i < n; i++) {
+		name = ents[i]->d_name;
+		if (strchr(name, ':') != NULL)
+			continue;
+		vendor  = read_int_attr(dir, name, "idVendor", 16);
+		product = read_int_attr(dir, name, "idProduct", 16);
+		busnum  = read_int_attr(dir, name, "busnum", 10);
+		devnum  = read_int_attr(dir, name, "devnum", 10);
+		if (vendor == -1 || product == -1 || busnum == -1 ||
+		    devnum == -1)
+			continue;
+		(void)snprintf(ugen, sizeof(ugen), "ugen%ld.%ld", busnum,
+		    devnum);
+		dip = add_usb_dev(devlist, ugen,
+		    read_attr(dir, name, "serial", serial, sizeof(serial)) == 0 ?
+		    serial : NULL, vendor, product,
+		    MAX(read_int_attr(dir, name, "bDeviceClass", 16), 0),
+		    MAX(read_int_attr(dir, name, "bDeviceSubClass", 16), 0));
+		if (dip == NULL)
+			continue;
+		add_usb_ifaces(dip, dir, ents, n, name);
+		ndevs++;
+	}
+	for (i = 0; i < n; i++)
+		free(ents[i]);
+	free(ents);
+
+	return (ndevs);
+}
+
+static void
+add_usb_ifaces(devinfo_t *dev, const char *dir, struct dirent **ents, int n,
+	const char *devname)
+{
+	int	   i;
+	long	   class;
+	size_t	   len;
+	const char *name;
+
+	len = strlen(devname);
+	for (i = 0; i < n; i++) {
+		name = ents[i]->d_name;
+		if (strncmp(name, devname, len) != 0 || name[len] != ':')
+			continue;
+		if ((class = read_int_attr(dir, name, "bInterfaceClass",
+		    16)) == -1)
+			continue;
+		add_iface(dev, class,
+		    MAX(read_int_attr(dir, name, "bInterfaceSubClass", 16), 0),
+		    MAX(read_int_attr(dir, name, "bInterfaceProtocol", 16), 0));
+	}
+}
+
+/*
+ * Returns the sorted entries of the given devices directory, and their
+ * number. A missing directory has no entries.
+ */
+static int
+scan_devs_dir(const char *dir, struct dirent ***ents)
+{
+	int n;
+
+	if ((n = scandir(dir, ents, NULL, alphasort)) == -1) {
+		if (errno != ENOENT)
+			die("scandir(%s)", dir);
+		*ents = NULL;
+		return (0);
+	}
+	return (n);
+}
+
+/*
+ * Reads the first line of the attribute file <dir>/<name>/<attr> into buf.
+ * Returns -1 if the attribute could not be read.
+ */
+static int
+read_attr(const char *dir, const char *name, const char *attr, char *buf,
+	size_t size)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	(void)snprintf(path, sizeof(path), "%s/%s/%s", dir, name, attr);
+	if ((fp = fopen(path, "r")) == NULL) {
+		if (errno != ENOENT)
+			logprint("fopen(%s)", path);
+		return (-1);
+	}
+	if (fgets(buf, size, fp) == NULL) {
+		(void)fclose(fp);
+		return (-1);
+	}
+	(void)fclose(fp);
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return (0);
+}
+
+/*
+ * Returns the value of the given integer attribute, or -1 if it could not
+ * be read.
+ */
+static long
+read_int_attr(const char *dir, const char *name, const char *attr, int base)
+{
+	char buf[32], *end;
+	long val;
+
+	if (read_attr(dir, name, attr, buf, sizeof(buf)) == -1)
+		return (-1);
+	val = strtol(buf, &end, base);
+	if (end == buf || val < 0)
+		return (-1);
+	return (val);
+}
@@ -14,28 +14,55 @@ ATF_TC_BODY(parse_devd_event, tc)
 			   "mode=host interface=0 endpoints=2 "		    \
 			   "intclass=0x08 intsubclass=0x06 intprotocol=0x50");
 
+	char *ev3 = strdup("? at slot=0 function=1 dbsf=pci0:3:0:1 "	    \
+			   "handle=\\_SB_.PCI0.RP01 pnpinfo vendor=0x8086 " \
+			   "device=0x1521 subvendor=0x15d9 "		    \
+			   "subdevice=0x1521 class=0x020000 on pci3");
+
 	ATF_REQUIRE(ev1 != NULL);
 	ATF_REQUIRE(ev2 != NULL);
+	ATF_REQUIRE(ev3 != NULL);
 
 	parse_devd_event(ev1);
 	ATF_CHECK_EQ(DEVD_SYSTEM_USB, devdevent.system);
 	ATF_CHECK_EQ(DEVD_TYPE_ATTACH, devdevent.type);
 	ATF_CHECK_STREQ("ugen4.3", devdevent.cdev);
 	ATF_CHECK_STREQ("DEVICE", devdevent.subsystem);
+	ATF_CHECK_STREQ("ugen4.3", devdevent.ugen);
+	ATF_CHECK_STREQ("host", devdevent.mode);
+	ATF_CHECK_STREQ("15H0FJ69EWI876TT", devdevent.sernum);
+	ATF_CHECK_EQ(0x8564, devdevent.vendor);
+	ATF_CHECK_EQ(0x1000, devdevent.product);
+	ATF_CHECK_EQ(0x00, devdevent.devclass);
+	ATF_CHECK_EQ(-1, devdevent.intclass);
 
 	parse_devd_event(ev2);
 	ATF_CHECK_EQ(DEVD_SYSTEM_USB, devdevent.system);
 	ATF_CHECK_EQ(DEVD_TYPE_ATTACH, devdevent.type);
 	ATF_CHECK_STREQ("ugen4.3", devdevent.cdev);
 	ATF_CHECK_STREQ("INTERFACE", devdevent.subsystem);
+	ATF_CHECK_EQ(0x08, devdevent.intclass);
+	ATF_CHECK_EQ(0x06, devdevent.intsubclass);
+	ATF_CHECK_EQ(0x50, devdevent.intprotocol);
+
+	/* Test that nomatch events on a PCI bus are PCI ATTACH events */
+	parse_devd_event(ev3);
+	ATF_CHECK_EQ(DEVD_SYSTEM_PCI, devdevent.system);
+	ATF_CHECK_EQ(DEVD_TYPE_ATTACH, devdevent.type);
+	ATF_CHECK_STREQ("pci0:3:0:1", devdevent.dbsf);
+	ATF_CHECK_EQ(0x8086, devdevent.vendor);
+	ATF_CHECK_EQ(0x1521, devdevent.product);
+	ATF_CHECK_EQ(0x15d9, devdevent.subvendor);
+	ATF_CHECK_EQ(0x020000, devdevent.pciclass);
 }
 
 ATF_TC_WITHOUT_HEAD(find_driver_db);
 ATF_TC_BODY(find_driver_db, tc)
 {
-	char	  *testdriver1, *testdriver2, *testdriver3, *testdriver4;
-	iface_t	  testdev4_iface;
-	devinfo_t testdev1, testdev2, testdev3, testdev4;
+	const char  *testdriver1, *testdriver2, *testdriver3, *testdriver4;
+	iface_t	    testdev4_iface;
+	devinfo_t   testdev1, testdev2, testdev3, testdev4;
+	db_cursor_t cursor;
 
 	open_drivers_db();
 	(void)memset(&testdev1, 0, sizeof(testdev1));
@@ -52,7 +79,8 @@ ATF_TC_BODY(find_driver_db, tc)
 	testdev1.subvendor = 0x103c;
 	testdev1.subdevice = 0x3102;
 
-	testdriver1 = find_driver_db(&testdev1);
+	init_db_cursor(driversdb, &testdev1, &cursor);
+	testdriver1 = next_db_driver(&cursor);
 	ATF_REQUIRE(testdriver1 != NULL);
 	ATF_CHECK_STREQ_MSG("if_bce", testdriver1, "drivername is %s",
 	    testdriver1);
@@ -63,10 +91,11 @@ ATF_TC_BODY(find_driver_db, tc)
 	testdev2.vendor = 0x14e4;
 	testdev2.device = 0x4306;
 
-	testdriver2 = find_driver_db(&testdev2);
+	init_db_cursor(driversdb, &testdev2, &cursor);
+	testdriver2 = next_db_driver(&cursor);
 	ATF_REQUIRE(testdriver2 != NULL);
 	ATF_CHECK_STREQ("if_bwn", testdriver2);
-	testdriver2 = find_driver_db(NULL);
+	testdriver2 = next_db_driver(&cursor);
 	ATF_REQUIRE(testdriver2 != NULL);
 	ATF_CHECK_STREQ("bwn_v4_ucode", testdriver2);
 
@@ -78,7 +107,8 @@ ATF_TC_BODY(find_driver_db, tc)
 	testdev3.device   = 0xabba;
 	testdev3.revision = 0x10;
 
-	testdriver3 = find_driver_db(&testdev3);
+	init_db_cursor(driversdb, &testdev3, &cursor);
+	testdriver3 = next_db_driver(&cursor);
 	ATF_REQUIRE(testdriver3 != NULL);
 	ATF_CHECK_STREQ("if_cas", testdriver3);
 
@@ -94,11 +124,1293 @@ ATF_TC_BODY(find_driver_db, tc)
 	testdev4.iface[0].subclass = 0x253;
 	testdev4.iface[0].protocol = 0x1;
 
-	testdriver4 = find_driver_db(&testdev4);
+	init_db_cursor(driversdb, &testdev4, &cursor);
+	testdriver4 = next_db_driver(&cursor);
 	ATF_REQUIRE(testdriver4 != NULL);
 	ATF_CHECK_STREQ("if_ipheth", testdriver4);
 }
 
+ATF_TC_WITHOUT_HEAD(match_ctx);
+ATF_TC_BODY(match_ctx, tc)
+{
+	devinfo_t   testdev1, testdev2;
+	match_ctx_t ctx1, ctx2;
+
+	open_drivers_db();
+	pnpindex = load_pnp_index();
+	(void)memset(&testdev1, 0, sizeof(testdev1));
+	(void)memset(&testdev2, 0, sizeof(testdev2));
+
+	testdev1.bus	  = BUS_TYPE_PCI;
+	testdev1.vendor   = 0x14e4;
+	testdev1.device   = 0x4306;
+	testdev2.bus	  = BUS_TYPE_PCI;
+	testdev2.vendor   = 0x108e;
+	testdev2.device   = 0xabba;
+	testdev2.revision = 0x10;
+
+	/*
+	 * Test that interleaved matches for different devices don't
+	 * interfere with each other.
+	 */
+	begin_match(&ctx1, driversdb, pnpindex, &testdev1);
+	begin_match(&ctx2, driversdb, pnpindex, &testdev2);
+	ATF_CHECK_STREQ("if_bwn", next_match(&ctx1));
+	ATF_CHECK_STREQ("if_cas", next_match(&ctx2));
+	ATF_CHECK_STREQ("bwn_v4_ucode", next_match(&ctx1));
+	end_match(&ctx1);
+	end_match(&ctx2);
+}
+
+ATF_TC_WITHOUT_HEAD(match_devlist);
+ATF_TC_BODY(match_devlist, tc)
+{
+	int	    i, n;
+	const char  *driver;
+	devinfo_t   testdevs[3], *devs[4];
+	match_ctx_t ctx;
+
+	open_drivers_db();
+	pnpindex = load_pnp_index();
+	ATF_CHECK(!is_pnp_index_stale(pnpindex));
+	(void)memset(testdevs, 0, sizeof(testdevs));
+
+	testdevs[0].vendor = 0x14e4;
+	testdevs[0].device = 0x4306;
+	testdevs[1].vendor = 0x8086;
+	testdevs[1].device = 0x423a;
+	testdevs[2].vendor = 0x14e4;
+	testdevs[2].device = 0x4306;
+	for (i = 0; i < 3; i++) {
+		testdevs[i].bus = BUS_TYPE_PCI;
+		devs[i] = &testdevs[i];
+	}
+	devs[i] = NULL;
+
+	match_devlist(driversdb, pnpindex, devs);
+	ATF_REQUIRE(testdevs[0].ndrivers >= 2);
+	ATF_CHECK_STREQ("if_bwn", testdevs[0].drivers[0]);
+	ATF_CHECK_STREQ("bwn_v4_ucode", testdevs[0].drivers[1]);
+	ATF_CHECK_EQ(testdevs[0].ndrivers, testdevs[2].ndrivers);
+
+	/*
+	 * The match context must not find any drivers match_devlist()
+	 * missed.
+	 */
+	for (i = 0; i < 3; i++) {
+		n = testdevs[i].ndrivers;
+		begin_match(&ctx, driversdb, pnpindex, &testdevs[i]);
+		while ((driver = next_match(&ctx)) != NULL)
+			add_driver(&testdevs[i], driver);
+		end_match(&ctx);
+		ATF_CHECK_EQ(n, testdevs[i].ndrivers);
+	}
+}
+
+/*
+ * Writes a small text drivers DB to path.
+ */
+static void
+write_test_db(const char *path, const char *records)
+{
+	FILE *fp;
+
+	ATF_REQUIRE((fp = fopen(path, "w")) != NULL);
+	(void)fputs(records, fp);
+	ATF_REQUIRE(fclose(fp) == 0);
+}
+
+ATF_TC_WITHOUT_HEAD(drivers_db_image);
+ATF_TC_BODY(drivers_db_image, tc)
+{
+	int	     i, fd, saved;
+	const char   *d1, *d2;
+	devinfo_t    dev;
+	db_cursor_t  c1, c2;
+	drivers_db_t *text, *image;
+	uint16_t     ids[][3] = {
+		{ 0x14e4, 0x4306, 0x00 }, { 0x8086, 0x423a, 0x00 },
+		{ 0x108e, 0xabba, 0x10 }, { 0x108e, 0xabba, 0x11 },
+		{ 0x1002, 0x0005, 0x00 }
+	};
+
+	write_test_db("test.db",
+	    "if_bwn bwn_v4_ucode\n\t14e4\n\t\t4306\n\t\t4307\n\n"
+	    "if_iwn\n\t8086\n\t\t423a\n\n"
+	    "if_cas\n\t108e\n\t\tabba revision=10\n\n"
+	    "if_test\n\t*\n\t\t0005\n\t8086\n\t\t*\n");
+	text = load_drivers_db("test.db");
+	ATF_REQUIRE(text != NULL);
+	ATF_REQUIRE(write_drivers_db(text, "test.db.bin") == 0);
+	image = map_drivers_db("test.db.bin");
+	ATF_REQUIRE(image != NULL);
+
+	/*
+	 * Test that the compiled image returns the same drivers in the
+	 * same order as the text DB.
+	 */
+	for (i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+		(void)memset(&dev, 0, sizeof(dev));
+		dev.vendor   = ids[i][0];
+		dev.device   = ids[i][1];
+		dev.revision = ids[i][2];
+		init_db_cursor(text, &dev, &c1);
+		init_db_cursor(image, &dev, &c2);
+		do {
+			d1 = next_db_driver(&c1);
+			d2 = next_db_driver(&c2);
+			ATF_REQUIRE((d1 == NULL) == (d2 == NULL));
+			if (d1 != NULL)
+				ATF_CHECK_STREQ(d1, d2);
+		} while (d1 != NULL);
+	}
+	free_drivers_db(text);
+	free_drivers_db(image);
+
+	/*
+	 * Test that an unknown key in the extra info column is reported
+	 * when the DB is loaded, and the record is loaded anyway.
+	 */
+	write_test_db("test.db", "if_test\n\t14e4\n\t\t4307 revision=01 "
+	    "bogus=1\n");
+	fd = open("test.log", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ATF_REQUIRE(fd != -1);
+	ATF_REQUIRE((saved = dup(STDERR_FILENO)) != -1);
+	ATF_REQUIRE(dup2(fd, STDERR_FILENO) != -1);
+	text = load_drivers_db("test.db");
+	(void)fflush(stderr);
+	ATF_REQUIRE(dup2(saved, STDERR_FILENO) != -1);
+	(void)close(saved);
+	(void)close(fd);
+	ATF_REQUIRE(text != NULL);
+	ATF_CHECK(atf_utils_grep_file("test.db:3: Unknown key 'bogus'",
+	    "test.log"));
+	(void)memset(&dev, 0, sizeof(dev));
+	dev.vendor   = 0x14e4;
+	dev.device   = 0x4307;
+	dev.revision = 0x01;
+	init_db_cursor(text, &dev, &c1);
+	ATF_CHECK_STREQ("if_test", next_db_driver(&c1));
+	ATF_CHECK(next_db_driver(&c1) == NULL);
+
+	/* The known keys of the record must still apply. */
+	dev.revision = 0x02;
+	init_db_cursor(text, &dev, &c1);
+	ATF_CHECK(next_db_driver(&c1) == NULL);
+	free_drivers_db(text);
+}
+
+ATF_TC_WITHOUT_HEAD(builtin_drivers_db);
+ATF_TC_BODY(builtin_drivers_db, tc)
+{
+	devinfo_t    testdev;
+	db_cursor_t  cursor;
+	drivers_db_t *builtin;
+
+	builtin = open_builtin_drivers_db();
+	ATF_REQUIRE(builtin != NULL);
+	(void)memset(&testdev, 0, sizeof(testdev));
+
+	testdev.vendor = 0x14e4;
+	testdev.device = 0x4306;
+	init_db_cursor(builtin, &testdev, &cursor);
+	ATF_CHECK_STREQ("if_bwn", next_db_driver(&cursor));
+	ATF_CHECK_STREQ("bwn_v4_ucode", next_db_driver(&cursor));
+	ATF_CHECK(next_db_driver(&cursor) == NULL);
+	free_drivers_db(builtin);
+}
+
+ATF_TC_WITHOUT_HEAD(overlay_drivers_db);
+ATF_TC_BODY(overlay_drivers_db, tc)
+{
+	devinfo_t    testdev;
+	db_cursor_t  cursor;
+	drivers_db_t *db, *builtin;
+
+	write_test_db("overlay.db", "if_test\n\t14e4\n\t\t4307\n");
+	ATF_REQUIRE((db = load_drivers_db("overlay.db")) != NULL);
+	ATF_REQUIRE((builtin = open_builtin_drivers_db()) != NULL);
+	overlay_drivers_db(db, builtin);
+	(void)memset(&testdev, 0, sizeof(testdev));
+
+	/* Test that a matching record of the overlay hides the base. */
+	testdev.vendor = 0x14e4;
+	testdev.device = 0x4307;
+	init_db_cursor(db, &testdev, &cursor);
+	ATF_CHECK_STREQ("if_test", next_db_driver(&cursor));
+	ATF_CHECK(next_db_driver(&cursor) == NULL);
+
+	/* Test that other devices are looked up in the base. */
+	testdev.device = 0x4306;
+	init_db_cursor(db, &testdev, &cursor);
+	ATF_CHECK_STREQ("if_bwn", next_db_driver(&cursor));
+	ATF_CHECK_STREQ("bwn_v4_ucode", next_db_driver(&cursor));
+	ATF_CHECK(next_db_driver(&cursor) == NULL);
+	free_drivers_db(db);
+}
+
+ATF_TC_WITHOUT_HEAD(dev_cache);
+ATF_TC_BODY(dev_cache, tc)
+{
+	int	    i;
+	FILE	    *fp;
+	char	    driver[16];
+	devinfo_t   testdev, cached, *dev;
+	devlist_t   *list;
+	dev_cache_t *cache;
+	const char  *deps[] = { "cache.dep", NULL };
+
+	ATF_REQUIRE((fp = fopen("cache.dep", "w")) != NULL);
+	(void)fputs("a\n", fp);
+	(void)fclose(fp);
+
+	(void)memset(&testdev, 0, sizeof(testdev));
+	testdev.bus    = BUS_TYPE_PCI;
+	testdev.vendor = 0x14e4;
+	testdev.device = 0x4306;
+	testdev.descr  = "Broadcom BCM4306";
+	testdev.descr_resolved = true;
+	add_driver(&testdev, "if_bwn");
+	add_driver(&testdev, "bwn_v4_ucode");
+
+	cache = open_dev_cache("cache.test", deps);
+	update_dev_cache(cache, &testdev);
+	ATF_REQUIRE(write_dev_cache(cache) == 0);
+	free_dev_cache(cache);
+
+	/*
+	 * Test that the cached entry is found after reopening the cache.
+	 */
+	(void)memset(&cached, 0, sizeof(cached));
+	cached.bus    = BUS_TYPE_PCI;
+	cached.vendor = 0x14e4;
+	cached.device = 0x4306;
+	cache = open_dev_cache("cache.test", deps);
+	ATF_REQUIRE(lookup_dev_cache(cache, &cached));
+	ATF_REQUIRE(cached.ndrivers == 2);
+	ATF_CHECK_STREQ("if_bwn", cached.drivers[0]);
+	ATF_CHECK_STREQ("bwn_v4_ucode", cached.drivers[1]);
+	ATF_CHECK(cached.descr_resolved);
+	ATF_CHECK_STREQ("Broadcom BCM4306", cached.descr);
+	cached.revision = 1;
+	ATF_CHECK(!lookup_dev_cache(cache, &cached));
+
+	/*
+	 * Test that each of many entries which only differ in their
+	 * interfaces is found.
+	 */
+	list = create_devlist();
+	for (i = 0; i < 1000; i++) {
+		dev = add_device(list);
+		dev->bus    = BUS_TYPE_USB;
+		dev->vendor = 0x046d;
+		dev->device = 0xc52b;
+		add_iface(dev, 3, 1, 2);
+		add_iface(dev, 3, i >> 8, i & 0xff);
+		(void)snprintf(driver, sizeof(driver), "driver%d", i);
+		add_driver(dev, driver);
+		update_dev_cache(cache, dev);
+	}
+	ATF_REQUIRE(write_dev_cache(cache) == 0);
+	free_dev_cache(cache);
+	free_devlist(list);
+	cache = open_dev_cache("cache.test", deps);
+	list = create_devlist();
+	for (i = 999; i >= 0; i--) {
+		dev = add_device(list);
+		dev->bus    = BUS_TYPE_USB;
+		dev->vendor = 0x046d;
+		dev->device = 0xc52b;
+		add_iface(dev, 3, 1, 2);
+		add_iface(dev, 3, i >> 8, i & 0xff);
+		ATF_REQUIRE(lookup_dev_cache(cache, dev));
+		(void)snprintf(driver, sizeof(driver), "driver%d", i);
+		ATF_REQUIRE(dev->ndrivers == 1);
+		ATF_CHECK_STREQ(driver, dev->drivers[0]);
+	}
+	dev = add_device(list);
+	dev->bus    = BUS_TYPE_USB;
+	dev->vendor = 0x046d;
+	dev->device = 0xc52b;
+	add_iface(dev, 3, 1, 2);
+	ATF_CHECK(!lookup_dev_cache(cache, dev));
+	cached.revision = 0;
+	ATF_CHECK(lookup_dev_cache(cache, &cached));
+	free_devlist(list);
+	free_dev_cache(cache);
+
+	/*
+	 * Test that changing a dependency invalidates the cache.
+	 */
+	ATF_REQUIRE((fp = fopen("cache.dep", "a")) != NULL);
+	(void)fputs("b\n", fp);
+	(void)fclose(fp);
+	cache = open_dev_cache("cache.test", deps);
+	ATF_CHECK(!lookup_dev_cache(cache, &cached));
+	free_dev_cache(cache);
+}
+
+ATF_TC_WITHOUT_HEAD(devlist);
+ATF_TC_BODY(devlist, tc)
+{
+	int	  i;
+	char	  driver[16];
+	devinfo_t *dev;
+	devlist_t *list, *copy;
+
+	list = create_devlist();
+	for (i = 0; i < 1000; i++) {
+		dev = add_device(list);
+		dev->vendor = i;
+		(void)snprintf(driver, sizeof(driver), "driver%d", i);
+		add_driver(dev, driver);
+		add_driver(dev, "common");
+		add_iface(dev, 3, 1, i & 0xff);
+	}
+	ATF_REQUIRE(list->ndevs == 1000);
+	ATF_CHECK(list->devs[1000] == NULL);
+	dev = list->devs[999];
+	ATF_CHECK(dev->vendor == 999);
+	ATF_REQUIRE(dev->ndrivers == 2);
+	ATF_CHECK_STREQ("driver999", dev->drivers[0]);
+	ATF_CHECK_STREQ("common", dev->drivers[1]);
+	ATF_CHECK(dev->nifaces == 1 && dev->iface[0].protocol == (999 & 0xff));
+
+	/*
+	 * Test that a removed USB device is unknown again, so a replugged
+	 * device is added anew.
+	 */
+	dev = add_usb_dev(list, "ugen1.2", NULL, 0x8564, 0x1000, 0, 0);
+	ATF_REQUIRE(dev != NULL);
+	add_driver(dev, "umass");
+	add_iface(dev, 8, 6, 0x50);
+	ATF_CHECK(add_usb_dev(list, "ugen1.2", NULL, 0x8564, 0x1000, 0, 0) == NULL);
+	remove_device(list, dev);
+	ATF_CHECK(list->ndevs == 1000);
+	ATF_CHECK(list->devs[1000] == NULL);
+	ATF_CHECK(find_dev(list, "ugen1.2") == NULL);
+
+	/* Test that identical devices at different locations are kept */
+	dev = add_usb_dev(list, "ugen1.3", "A1", 0x8564, 0x1000, 0, 0);
+	ATF_REQUIRE(dev != NULL);
+	ATF_CHECK(add_usb_dev(list, "ugen1.4", "A2", 0x8564, 0x1000, 0, 0) !=
+	    NULL);
+	ATF_CHECK(find_dev(list, "ugen1.3") == dev);
+	ATF_CHECK_STREQ("A1", dev->serial);
+	ATF_CHECK_STREQ("A2", find_dev(list, "ugen1.4")->serial);
+
+	/* Test copying devices found on resync */
+	add_iface(dev, 8, 6, 0x50);
+	copy = create_devlist();
+	ATF_REQUIRE((dev = copy_device(copy, dev)) != NULL);
+	ATF_CHECK(copy_device(copy, dev) == NULL);
+	ATF_CHECK(find_dev(copy, "ugen1.3") == dev);
+	ATF_CHECK_STREQ("A1", dev->serial);
+	ATF_CHECK(dev->nifaces == 1 && dev->iface[0].protocol == 0x50);
+	ATF_CHECK(copy_device(copy, list->devs[0]) == NULL);
+	free_devlist(copy);
+	free_devlist(list);
+}
+
+/*
+ * Parses the given devd event, and updates the device list accordingly.
+ */
+static void
+feed_devd_event(const char *str)
+{
+	char *ev;
+
+	ATF_REQUIRE((ev = strdup(str)) != NULL);
+	ATF_REQUIRE(parse_devd_event(ev) == 0);
+	handle_devd_event();
+	free(ev);
+}
+
+ATF_TC_WITHOUT_HEAD(usb_events);
+ATF_TC_BODY(usb_events, tc)
+{
+	devinfo_t *dev;
+
+	devlist = create_devlist();
+	nprocessed = 0;
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen4.3 cdev=ugen4.3 vendor=0x8564 "	    \
+			"product=0x1000 devclass=0x00 devsubclass=0x00 "    \
+			"sernum=\"15H0FJ69EWI876TT\" mode=host");
+	ATF_REQUIRE(devlist->ndevs == 1);
+	ATF_REQUIRE((dev = find_dev(devlist, "ugen4.3")) != NULL);
+	feed_devd_event("!system=USB subsystem=INTERFACE type=ATTACH "	    \
+			"ugen=ugen4.3 cdev=ugen4.3 vendor=0x8564 "	    \
+			"product=0x1000 devclass=0x00 devsubclass=0x00 "    \
+			"mode=host interface=0 intclass=0x08 "		    \
+			"intsubclass=0x06 intprotocol=0x50");
+	ATF_CHECK(dev->nifaces == 1 && dev->iface[0].class == 0x08);
+	ATF_CHECK_EQ(0, nprocessed);
+
+	/*
+	 * Test that a processed device is queued again if an interface
+	 * is added after the attach timer fired.
+	 */
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen4.4 cdev=ugen4.4 vendor=0x046d "	    \
+			"product=0xc52b devclass=0x00 devsubclass=0x00 "    \
+			"mode=host");
+	ATF_REQUIRE(devlist->ndevs == 2);
+	nprocessed = devlist->ndevs;
+	feed_devd_event("!system=USB subsystem=INTERFACE type=ATTACH "	    \
+			"ugen=ugen4.3 cdev=ugen4.3 vendor=0x8564 "	    \
+			"product=0x1000 devclass=0x00 devsubclass=0x00 "    \
+			"mode=host interface=1 intclass=0x03 "		    \
+			"intsubclass=0x01 intprotocol=0x01");
+	ATF_CHECK_EQ(1, nprocessed);
+	ATF_CHECK(devlist->devs[1] == dev);
+	ATF_CHECK(devlist->devs[0] == find_dev(devlist, "ugen4.4"));
+	ATF_CHECK(dev->nifaces == 2 && dev->iface[1].class == 0x03);
+	free_devlist(devlist);
+	devlist = NULL;
+}
+
+ATF_TC_WITHOUT_HEAD(pci_events);
+ATF_TC_BODY(pci_events, tc)
+{
+	devinfo_t *dev;
+
+	devlist = create_devlist();
+	nprocessed = 0;
+	feed_devd_event("? at slot=0 function=1 dbsf=pci0:3:0:1 "	    \
+			"handle=\\_SB_.PCI0.RP01 pnpinfo vendor=0x8086 "   \
+			"device=0x1521 subvendor=0x15d9 "		    \
+			"subdevice=0x1521 class=0x020000 on pci3");
+	ATF_REQUIRE(devlist->ndevs == 1);
+	ATF_REQUIRE((dev = find_dev(devlist, "pci0:3:0:1")) != NULL);
+	ATF_CHECK(dev->vendor == 0x8086 && dev->device == 0x1521);
+	ATF_CHECK(dev->class == 0x02 && dev->subclass == 0x00);
+	nprocessed = devlist->ndevs;
+
+	/* Test that detaching a device's driver removes the device */
+	feed_devd_event("-igb0 at slot=0 function=1 dbsf=pci0:3:0:1 "	    \
+			"handle=\\_SB_.PCI0.RP01 on pci3");
+	ATF_CHECK_EQ(DEVD_SYSTEM_PCI, devdevent.system);
+	ATF_CHECK_EQ(DEVD_TYPE_DETACH, devdevent.type);
+	ATF_CHECK_EQ(0, devlist->ndevs);
+	ATF_CHECK_EQ(0, nprocessed);
+	ATF_CHECK(find_dev(devlist, "pci0:3:0:1") == NULL);
+
+	/* Detach events of other buses must be ignored. */
+	feed_devd_event("-ukbd0 at bus=0 hubaddr=1 port=3 devaddr=2 "	    \
+			"interface=0 ugen=ugen0.2 on uhub0");
+	ATF_CHECK_EQ(-1, devdevent.system);
+	free_devlist(devlist);
+	devlist = NULL;
+}
+
+/*
+ * Creates a configuration from the given Lua code.
+ */
+static config_t *
+create_test_cfg(const char *code)
+{
+	config_t *c;
+
+	ATF_REQUIRE((c = calloc(1, sizeof(config_t))) != NULL);
+	ATF_REQUIRE((c->luastate = luaL_newstate()) != NULL);
+	luaL_openlibs(c->luastate);
+	ATF_REQUIRE(luaL_dostring(c->luastate, code) == 0);
+
+	return (c);
+}
+
+static void
+free_test_cfg(config_t *c)
+{
+	lua_close(c->luastate);
+	free(c);
+}
+
+/*
+ * Checks the value of the given global string variable of c.
+ */
+static void
+check_cfg_str(config_t *c, const char *var, const char *val)
+{
+	lua_getglobal(c->luastate, var);
+	ATF_CHECK_STREQ(val, lua_tostring(c->luastate, -1));
+	lua_settop(c->luastate, 0);
+}
+
+ATF_TC_WITHOUT_HEAD(usb_detach);
+ATF_TC_BODY(usb_detach, tc)
+{
+	devinfo_t *dev;
+
+	cfg = create_test_cfg("removed = \"\"\n"			    \
+			      "function on_remove_device(dev)\n"	    \
+			      "  removed = removed .. dev.ugen .. \" \"\n"  \
+			      "  return 0\n"				    \
+			      "end\n");
+	devlist = create_devlist();
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen0.2 vendor=0x8564 product=0x1000 "	    \
+			"sernum=\"A1\" mode=host");
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen0.3 vendor=0x046d product=0xc52b "	    \
+			"mode=host");
+	nprocessed = devlist->ndevs;
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen0.4 vendor=0x0781 product=0x5567 "	    \
+			"mode=host");
+	ATF_REQUIRE(devlist->ndevs == 3);
+
+	/* Test that a pending device is removed silently */
+	feed_devd_event("!system=USB subsystem=DEVICE type=DETACH "	    \
+			"ugen=ugen0.4 vendor=0x0781 product=0x5567 "	    \
+			"mode=host");
+	ATF_CHECK_EQ(2, devlist->ndevs);
+	ATF_CHECK_EQ(2, nprocessed);
+	check_cfg_str(cfg, "removed", "");
+
+	/* Test that removing a processed device adjusts nprocessed */
+	feed_devd_event("!system=USB subsystem=DEVICE type=DETACH "	    \
+			"ugen=ugen0.2 vendor=0x8564 product=0x1000 "	    \
+			"sernum=\"A1\" mode=host");
+	ATF_CHECK_EQ(1, devlist->ndevs);
+	ATF_CHECK_EQ(1, nprocessed);
+	ATF_CHECK(find_dev(devlist, "ugen0.2") == NULL);
+	check_cfg_str(cfg, "removed", "ugen0.2 ");
+
+	/* Test that a replugged device is processed again */
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen0.2 vendor=0x8564 product=0x1000 "	    \
+			"sernum=\"A1\" mode=host");
+	ATF_REQUIRE((dev = find_dev(devlist, "ugen0.2")) != NULL);
+	ATF_CHECK(is_pending(dev, nprocessed));
+	ATF_CHECK_STREQ("A1", dev->serial);
+
+	/*
+	 * Test that a device whose ugen name was reused replaces the old
+	 * one, whose DETACH event was missed.
+	 */
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen0.3 vendor=0x0781 product=0x5567 "	    \
+			"mode=host");
+	ATF_CHECK_EQ(2, devlist->ndevs);
+	ATF_CHECK_EQ(0, nprocessed);
+	ATF_REQUIRE((dev = find_dev(devlist, "ugen0.3")) != NULL);
+	ATF_CHECK(dev->vendor == 0x0781 && is_pending(dev, nprocessed));
+	check_cfg_str(cfg, "removed", "ugen0.2 ugen0.3 ");
+
+	/* Test that repeated ATTACH events don't add the device again */
+	feed_devd_event("!system=USB subsystem=DEVICE type=ATTACH "	    \
+			"ugen=ugen0.3 vendor=0x0781 product=0x5567 "	    \
+			"mode=host");
+	ATF_CHECK_EQ(2, devlist->ndevs);
+	ATF_CHECK(find_dev(devlist, "ugen0.3") == dev);
+	free_devlist(devlist);
+	devlist = NULL;
+	free_test_cfg(cfg);
+	cfg = NULL;
+}
+
+ATF_TC_WITHOUT_HEAD(attach_delay);
+ATF_TC_BODY(attach_delay, tc)
+{
+	struct timespec t = { 100, 900000000 };
+
+	attach_wait = 50;
+	attach_wait_max = 500;
+	attach_scheduled = false;
+	ATF_CHECK_EQ(50, attach_delay(&t));
+	ATF_CHECK(attach_scheduled);
+
+	/* Test that each event restarts the quiet window */
+	t.tv_sec++;
+	t.tv_nsec = 100000000;
+	ATF_CHECK_EQ(50, attach_delay(&t));
+
+	/* Test that the delay is capped by attach_wait_max */
+	t.tv_nsec = 380000000;
+	ATF_CHECK_EQ(20, attach_delay(&t));
+	t.tv_nsec = 400000000;
+	ATF_CHECK_EQ(0, attach_delay(&t));
+	t.tv_sec += 2;
+	ATF_CHECK_EQ(0, attach_delay(&t));
+
+	/* Test that the next burst starts a new window */
+	attach_scheduled = false;
+	ATF_CHECK_EQ(50, attach_delay(&t));
+	attach_wait = 0;
+	ATF_CHECK_EQ(0, attach_delay(&t));
+	attach_wait = ATTACH_WAIT;
+	attach_wait_max = ATTACH_WAIT_MAX;
+	attach_scheduled = false;
+}
+
+ATF_TC_WITHOUT_HEAD(file_watch);
+ATF_TC_BODY(file_watch, tc)
+{
+	int	     fd;
+	FILE	     *fp;
+	fd_set	     rset;
+	file_watch_t *fw;
+	struct timeval tv;
+	const char   *files[] = { "watch.test", NULL };
+
+	ATF_REQUIRE((fw = open_file_watch(files)) != NULL);
+	fd = file_watch_fd(fw);
+	ATF_CHECK(!read_file_watch(fw));
+
+	/*
+	 * Test that creating the file is noticed, and that the event
+	 * is consumed.
+	 */
+	ATF_REQUIRE((fp = fopen("watch.test", "w")) != NULL);
+	(void)fputs("a\n", fp);
+	(void)fclose(fp);
+	FD_ZERO(&rset); FD_SET(fd, &rset);
+	tv.tv_sec = 5; tv.tv_usec = 0;
+	ATF_REQUIRE(select(fd + 1, &rset, NULL, NULL, &tv) == 1);
+	ATF_CHECK(read_file_watch(fw));
+	ATF_CHECK(!read_file_watch(fw));
+
+	/*
+	 * Test that replacing the file by renaming is noticed.
+	 */
+	ATF_REQUIRE((fp = fopen("watch.tmp", "w")) != NULL);
+	(void)fputs("b\n", fp);
+	(void)fclose(fp);
+	ATF_REQUIRE(rename("watch.tmp", "watch.test") == 0);
+	FD_ZERO(&rset); FD_SET(fd, &rset);
+	tv.tv_sec = 5; tv.tv_usec = 0;
+	ATF_REQUIRE(select(fd + 1, &rset, NULL, NULL, &tv) == 1);
+	ATF_CHECK(read_file_watch(fw));
+	free_file_watch(fw);
+}
+
+static void
+write_sysfs_attr(const char *dev, const char *attr, const char *val)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	(void)snprintf(path, sizeof(path), "%s/%s", dev, attr);
+	ATF_REQUIRE((fp = fopen(path, "w")) != NULL);
+	(void)fprintf(fp, "%s\n", val);
+	(void)fclose(fp);
+}
+
+static void
+count_event(void *arg)
+{
+	(*(int *)arg)++;
+}
+
+ATF_TC_WITHOUT_HEAD(event_loop);
+ATF_TC_BODY(event_loop, tc)
+{
+	int	     fd[2], nread, ntimer, nperiodic, nsignal;
+	char	     c;
+	event_loop_t *loop;
+
+	nread = ntimer = nperiodic = nsignal = 0;
+	ATF_REQUIRE((loop = create_event_loop()) != NULL);
+	ATF_REQUIRE(pipe(fd) == 0);
+
+	/* Test fd readiness */
+	ATF_REQUIRE(watch_fd(loop, fd[0], count_event, &nread) == 0);
+	ATF_REQUIRE(write(fd[1], "x", 1) == 1);
+	dispatch_events(loop);
+	ATF_CHECK_EQ(1, nread);
+	ATF_REQUIRE(read(fd[0], &c, 1) == 1);
+	unwatch_fd(loop, fd[0]);
+
+	/* Test that a restarted timer expires once */
+	ATF_REQUIRE(set_timer(loop, 1, 10, false, count_event, &ntimer) == 0);
+	ATF_REQUIRE(set_timer(loop, 1, 20, false, count_event, &ntimer) == 0);
+	ATF_REQUIRE(set_timer(loop, 2, 5, true, count_event, &nperiodic) == 0);
+	while (ntimer == 0)
+		dispatch_events(loop);
+	ATF_CHECK_EQ(1, ntimer);
+	ATF_CHECK(nperiodic >= 2);
+	cancel_timer(loop, 2);
+
+	/* Test signals */
+	ATF_REQUIRE(watch_signal(loop, SIGUSR1, count_event, &nsignal) == 0);
+	ATF_REQUIRE(raise(SIGUSR1) == 0);
+	dispatch_events(loop);
+	ATF_CHECK_EQ(1, nsignal);
+
+	free_event_loop(loop);
+	(void)close(fd[0]);
+	(void)close(fd[1]);
+}
+
+/*
+ * Helpers to write a linker.hints file in the format of kldxref(8).
+ */
+static void
+put_hints_int(char *buf, size_t *pos, int val)
+{
+	*pos = roundup2(*pos, sizeof(int));
+	(void)memcpy(buf + *pos, &val, sizeof(int));
+	*pos += sizeof(int);
+}
+
+static void
+put_hints_str(char *buf, size_t *pos, const char *str)
+{
+	buf[(*pos)++] = strlen(str);
+	(void)memcpy(buf + *pos, str, strlen(str));
+	*pos += strlen(str);
+}
+
+static void
+put_hints_module(char *buf, size_t *pos, const char *kmod)
+{
+	char   name[64];
+	size_t start;
+
+	start = *pos = roundup2(*pos, sizeof(int));
+	*pos += sizeof(int);
+	(void)snprintf(name, sizeof(name), "%s.ko", kmod);
+	put_hints_int(buf, pos, MDT_MODULE);
+	put_hints_str(buf, pos, kmod);
+	put_hints_str(buf, pos, name);
+	*pos = roundup2(*pos, sizeof(int));
+	*(int *)(buf + start) = *pos - start - sizeof(int);
+}
+
+/*
+ * Writes a PNP info list with nrecs records of nfields integers each.
+ */
+static void
+put_hints_pnp(char *buf, size_t *pos, const char *bus, const char *fmt,
+	int nrecs, int nfields, const int *vals)
+{
+	int    i;
+	size_t start;
+
+	start = *pos = roundup2(*pos, sizeof(int));
+	*pos += sizeof(int);
+	put_hints_int(buf, pos, MDT_PNP_INFO);
+	put_hints_str(buf, pos, bus);
+	put_hints_str(buf, pos, fmt);
+	put_hints_int(buf, pos, nrecs);
+	for (i = 0; i < nrecs * nfields; i++)
+		put_hints_int(buf, pos, vals[i]);
+	*pos = roundup2(*pos, sizeof(int));
+	*(int *)(buf + start) = *pos - start - sizeof(int);
+}
+
+static const char *
+next_hints_match(const pnp_index_t *idx, devinfo_t *dev, int bus,
+	uint16_t vendor, uint16_t device)
+{
+	pnp_cursor_t cur;
+
+	dev->bus    = bus;
+	dev->vendor = vendor;
+	dev->device = device;
+	init_pnp_cursor(&cur, idx, dev);
+	return (next_pnp_driver(&cur));
+}
+
+ATF_TC_WITHOUT_HEAD(pnp_index);
+ATF_TC_BODY(pnp_index, tc)
+{
+	int	    fd;
+	char	    buf[4096];
+	size_t	    pos;
+	iface_t	    ifaces[2];
+	devinfo_t   dev;
+	pnp_index_t *idx;
+	const char  *saved[2];
+	const char  *usbfmt = "M16:mask;I:vendor;I:product;L:release;"
+			      "G:release;I:devclass;I:devsubclass;"
+			      "I:devprotocol;I:intclass;I:intsubclass;"
+			      "I:intprotocol;T:mode=host";
+	const int   pcivals[] = { 0x8086, 0x1234 };
+	const int   anyvals[] = { 0x10ec, -1 };
+	const int   tvals[]   = { 0x5555 };
+	const int   usbvals[] = {
+		/* Vendor and interface class */
+		0x081, 0x1111, 0x9999, 0, 0, 0, 0, 0, 8, 0, 0,
+		/* Interface class, subclass and protocol only */
+		0x380, 0, 0, 0, 0, 0, 0, 0, 3, 1, 1
+	};
+
+	pos = 0;
+	put_hints_int(buf, &pos, LINKER_HINTS_VERSION);
+	put_hints_module(buf, &pos, "pcidrv");
+	put_hints_pnp(buf, &pos, "pci", "I:vendor;I:device;", 1, 2, pcivals);
+	put_hints_module(buf, &pos, "anydrv");
+	put_hints_pnp(buf, &pos, "pci", "I:vendor;J:device;", 1, 2, anyvals);
+	put_hints_module(buf, &pos, "usbdrv");
+	put_hints_pnp(buf, &pos, "usb", usbfmt, 2, 11, usbvals);
+	put_hints_module(buf, &pos, "usbtdrv");
+	put_hints_pnp(buf, &pos, "usb", "T:vendor=0x2222;I:product;", 1, 1,
+	    tvals);
+	put_hints_module(buf, &pos, "usbdevmode");
+	put_hints_pnp(buf, &pos, "usb", "I:vendor;I:product;T:mode=device",
+	    1, 2, pcivals);
+	fd = open("linker.hints", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ATF_REQUIRE(fd != -1);
+	ATF_REQUIRE(write(fd, buf, pos) == (ssize_t)pos);
+	(void)close(fd);
+
+	saved[0] = hints_paths[0]; saved[1] = hints_paths[1];
+	hints_paths[0] = "linker.hints"; hints_paths[1] = NULL;
+	idx = load_pnp_index();
+	hints_paths[0] = saved[0]; hints_paths[1] = saved[1];
+	ATF_REQUIRE(idx != NULL);
+
+	(void)memset(&dev, 0, sizeof(dev));
+	dev.iface = ifaces;
+
+	/* PCI records don't match USB devices, and vice versa. */
+	ATF_CHECK_STREQ("pcidrv",
+	    next_hints_match(idx, &dev, BUS_TYPE_PCI, 0x8086, 0x1234));
+	ATF_CHECK(next_hints_match(idx, &dev, BUS_TYPE_USB, 0x8086,
+	    0x1234) == NULL);
+
+	/* J fields with -1 match any value. */
+	ATF_CHECK_STREQ("anydrv",
+	    next_hints_match(idx, &dev, BUS_TYPE_PCI, 0x10ec, 0x8168));
+
+	/*
+	 * The mask selects the vendor and the interface class, so the
+	 * product is ignored, but the interface class must match.
+	 */
+	dev.nifaces = 1;
+	ifaces[0].class = 8; ifaces[0].subclass = 6; ifaces[0].protocol = 80;
+	ATF_CHECK_STREQ("usbdrv",
+	    next_hints_match(idx, &dev, BUS_TYPE_USB, 0x1111, 0x42));
+	ifaces[0].class = 3;
+	ATF_CHECK(next_hints_match(idx, &dev, BUS_TYPE_USB, 0x1111,
+	    0x42) == NULL);
+
+	/* Interface fields must all match the same interface. */
+	ifaces[0].class = 3; ifaces[0].subclass = 1; ifaces[0].protocol = 1;
+	ATF_CHECK_STREQ("usbdrv",
+	    next_hints_match(idx, &dev, BUS_TYPE_USB, 0x046d, 0xc52b));
+	dev.nifaces = 2;
+	ifaces[0].protocol = 2;
+	ifaces[1].class = 8; ifaces[1].subclass = 6; ifaces[1].protocol = 1;
+	ATF_CHECK(next_hints_match(idx, &dev, BUS_TYPE_USB, 0x046d,
+	    0xc52b) == NULL);
+
+	/* T:vendor= sets the vendor of the whole list. */
+	dev.nifaces = 0;
+	ATF_CHECK_STREQ("usbtdrv",
+	    next_hints_match(idx, &dev, BUS_TYPE_USB, 0x2222, 0x5555));
+	ATF_CHECK(next_hints_match(idx, &dev, BUS_TYPE_USB, 0x3333,
+	    0x5555) == NULL);
+
+	/* Lists for USB device mode are skipped. */
+	ATF_CHECK(next_hints_match(idx, &dev, BUS_TYPE_USB, 0x8086,
+	    0x1234) == NULL);
+	free_pnp_index(idx);
+}
+
+ATF_TC_WITHOUT_HEAD(devd_reader);
+ATF_TC_BODY(devd_reader, tc)
+{
+	int	      fd[2], nsent, nrecvd;
+	char	      msg[64], big[1536], *p;
+	size_t	      len;
+	double	      ms;
+	devd_reader_t *r;
+	struct timespec start, end;
+
+	/* The socket pair stands in for devd. */
+	ATF_REQUIRE(socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, fd) == 0);
+	ATF_REQUIRE(fcntl(fd[0], F_SETFL, O_NONBLOCK) == 0);
+	ATF_REQUIRE(fcntl(fd[1], F_SETFL, O_NONBLOCK) == 0);
+	ATF_REQUIRE((r = open_devd_reader(fd[0])) != NULL);
+
+	/* Flood the reader with events, and check their order. */
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	for (nsent = nrecvd = 0; nrecvd < 100000;) {
+		for (; nsent < 100000; nsent++) {
+			len = snprintf(msg, sizeof(msg), "+uhub0 at bus=%d",
+			    nsent);
+			if (send(fd[1], msg, len, 0) == -1)
+				break;
+		}
+		ATF_REQUIRE(read_devd_msgs(r) >= 0);
+		while ((p = next_devd_msg(r, &len)) != NULL) {
+			(void)snprintf(msg, sizeof(msg), "+uhub0 at bus=%d",
+			    nrecvd++);
+			ATF_REQUIRE_STREQ(msg, p);
+			ATF_REQUIRE_EQ(strlen(msg), len);
+		}
+	}
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	if (atf_tc_has_config_var(tc, "benchmark")) {
+		ms = (end.tv_sec - start.tv_sec) * 1000.0 +
+		    (end.tv_nsec - start.tv_nsec) / 1000000.0;
+		(void)printf("%d events read in %.3f ms\n", nrecvd, ms);
+	}
+
+	/* A truncated message is dropped, and the next one fits. */
+	(void)memset(big, 'x', sizeof(big));
+	ATF_REQUIRE(send(fd[1], big, sizeof(big), 0) == sizeof(big));
+	ATF_CHECK_EQ(0, read_devd_msgs(r));
+	ATF_REQUIRE(send(fd[1], big, sizeof(big), 0) == sizeof(big));
+	ATF_CHECK_EQ(1, read_devd_msgs(r));
+	ATF_REQUIRE((p = next_devd_msg(r, &len)) != NULL);
+	ATF_CHECK_EQ(sizeof(big), len);
+	ATF_CHECK(next_devd_msg(r, NULL) == NULL);
+
+	/* Test EOF */
+	(void)close(fd[1]);
+	ATF_CHECK_EQ(-1, read_devd_msgs(r));
+	ATF_CHECK_EQ(ECONNRESET, errno);
+	free_devd_reader(r);
+	(void)close(fd[0]);
+}
+
+static void *
+push_msgs(void *arg)
+{
+	int	    i;
+	char	    buf[16], *msg;
+	msg_queue_t *q = arg;
+
+	for (i = 0; i < 100000; i++) {
+		(void)snprintf(buf, sizeof(buf), "%d", i);
+		if ((msg = strdup(buf)) == NULL)
+			return (NULL);
+		push_msg_wait(q, msg);
+		wake_msg_queue(q);
+	}
+	return (NULL);
+}
+
+ATF_TC_WITHOUT_HEAD(msg_queue);
+ATF_TC_BODY(msg_queue, tc)
+{
+	int	      n;
+	char	      *msg;
+	pthread_t     producer;
+	msg_queue_t   *q;
+	struct pollfd pfd;
+
+	ATF_REQUIRE((q = create_msg_queue(100)) != NULL);
+	ATF_CHECK_EQ(128, msg_queue_size(q));
+	ATF_REQUIRE(pthread_create(&producer, NULL, push_msgs, q) == 0);
+
+	/* Messages must arrive in order, and wakeups must not get lost. */
+	pfd.fd = msg_queue_fd(q);
+	pfd.events = POLLIN;
+	for (n = 0; n < 100000;) {
+		ATF_REQUIRE(poll(&pfd, 1, 5000) == 1);
+		ack_msg_queue(q);
+		while ((msg = pop_msg(q)) != NULL) {
+			ATF_REQUIRE_EQ(n++, atoi(msg));
+			free(msg);
+		}
+	}
+	ATF_REQUIRE(pthread_join(producer, NULL) == 0);
+	ATF_CHECK_EQ(0, msg_queue_depth(q));
+	ATF_CHECK(msg_queue_hwm(q) >= 1 && msg_queue_hwm(q) <= 128);
+	free_msg_queue(q);
+}
+
+ATF_TC_WITHOUT_HEAD(sysfs_backend);
+ATF_TC_BODY(sysfs_backend, tc)
+{
+	devinfo_t  **devs;
+	devlist_t  *list;
+	const char *pci = "sys/bus/pci/devices/0000:00:1f.2";
+	const char *usb = "sys/bus/usb/devices/1-1";
+	const char *usbif = "sys/bus/usb/devices/1-1:1.0";
+
+	ATF_REQUIRE(mkdir("sys", 0755) == 0);
+	ATF_REQUIRE(mkdir("sys/bus", 0755) == 0);
+	ATF_REQUIRE(mkdir("sys/bus/pci", 0755) == 0);
+	ATF_REQUIRE(mkdir("sys/bus/pci/devices", 0755) == 0);
+	ATF_REQUIRE(mkdir("sys/bus/usb", 0755) == 0);
+	ATF_REQUIRE(mkdir("sys/bus/usb/devices", 0755) == 0);
+	ATF_REQUIRE(mkdir(pci, 0755) == 0);
+	ATF_REQUIRE(mkdir(usb, 0755) == 0);
+	ATF_REQUIRE(mkdir(usbif, 0755) == 0);
+
+	write_sysfs_attr(pci, "vendor", "0x8086");
+	write_sysfs_attr(pci, "device", "0x2922");
+	write_sysfs_attr(pci, "subsystem_vendor", "0x1af4");
+	write_sysfs_attr(pci, "subsystem_device", "0x1100");
+	write_sysfs_attr(pci, "class", "0x010601");
+	write_sysfs_attr(pci, "revision", "0x02");
+
+	write_sysfs_attr(usb, "idVendor", "8564");
+	write_sysfs_attr(usb, "idProduct", "1000");
+	write_sysfs_attr(usb, "bDeviceClass", "00");
+	write_sysfs_attr(usb, "bDeviceSubClass", "00");
+	write_sysfs_attr(usb, "busnum", "1");
+	write_sysfs_attr(usb, "devnum", "3");
+	write_sysfs_attr(usb, "serial", "15H0FJ69EWI876TT");
+	write_sysfs_attr(usbif, "bInterfaceClass", "08");
+	write_sysfs_attr(usbif, "bInterfaceSubClass", "06");
+	write_sysfs_attr(usbif, "bInterfaceProtocol", "50");
+
+	ATF_REQUIRE(!set_dev_backend("nosuchbackend", NULL));
+	ATF_REQUIRE(set_dev_backend("sysfs", "sys"));
+	list = create_devlist();
+
+	ATF_REQUIRE((devs = get_pci_devs(list)) != NULL);
+	ATF_CHECK(devs[1] == NULL);
+	ATF_CHECK(devs[0]->bus == BUS_TYPE_PCI);
+	ATF_CHECK(devs[0]->vendor == 0x8086 && devs[0]->device == 0x2922);
+	ATF_CHECK(devs[0]->subvendor == 0x1af4 &&
+	    devs[0]->subdevice == 0x1100);
+	ATF_CHECK(devs[0]->class == 0x01 && devs[0]->subclass == 0x06);
+	ATF_CHECK(devs[0]->revision == 0x02);
+
+	ATF_REQUIRE((devs = get_usb_devs(list)) != NULL);
+	ATF_CHECK(devs[1] == NULL);
+	ATF_CHECK(devs[0]->bus == BUS_TYPE_USB);
+	ATF_CHECK(devs[0]->vendor == 0x8564 && devs[0]->device == 0x1000);
+	ATF_CHECK_STREQ("ugen1.3", devs[0]->ugen);
+	ATF_CHECK_STREQ("15H0FJ69EWI876TT", devs[0]->serial);
+	ATF_REQUIRE(devs[0]->nifaces == 1);
+	ATF_CHECK(devs[0]->iface[0].class == 0x08);
+	ATF_CHECK(devs[0]->iface[0].subclass == 0x06);
+	ATF_CHECK(devs[0]->iface[0].protocol == 0x50);
+
+	/* Test that known devices are not added again */
+	ATF_CHECK(get_pci_devs(list) == NULL);
+	ATF_CHECK(get_usb_devs(list) == NULL);
+	ATF_CHECK(find_dev(list, "pci0:0:31:2") != NULL);
+	free_devlist(list);
+}
+
+ATF_TC_WITHOUT_HEAD(replay_backend);
+ATF_TC_BODY(replay_backend, tc)
+{
+	FILE	  *fp;
+	devinfo_t **devs;
+	devlist_t *list;
+
+	ATF_REQUIRE((fp = fopen("inventory.test", "w")) != NULL);
+	(void)fprintf(fp,
+	    "# Snapshot\n"
+	    "vendor=8086 product=2922 class=01 subclass=06 bus=PCI "
+	    "SATA controller: ahci\n"
+	    "vendor=8564 product=1000 class=00 subclass=00 bus=USB "
+	    "Flash drive: umass\n"
+	    "vendor=8564 product=1000 ifclass=08 ifsubclass=06 bus=USB "
+	    "protocol=50 Flash drive: umass\n"
+	    "vendor=8564 product=1000 class=00 subclass=00 bus=USB "
+	    "Flash drive: ugen\n"
+	    "vendor=8564 product=1000 ifclass=08 ifsubclass=06 bus=USB "
+	    "protocol=50 Flash drive: ugen\n"
+	    "vendor=10ec product=8168 subvendor=1043 subdevice=8432 "
+	    "class=02 subclass=00 bus=PCI Ethernet controller: re\n");
+	(void)fclose(fp);
+
+	ATF_REQUIRE(set_dev_backend("replay", "inventory.test"));
+	list = create_devlist();
+	ATF_REQUIRE((devs = get_pci_devs(list)) != NULL);
+	ATF_REQUIRE(devs[0] != NULL && devs[1] != NULL);
+	ATF_CHECK(devs[2] == NULL);
+	ATF_CHECK(devs[0]->vendor == 0x8086 && devs[0]->device == 0x2922);
+	ATF_CHECK(devs[0]->class == 0x01 && devs[0]->subclass == 0x06);
+	ATF_CHECK(devs[1]->subvendor == 0x1043 &&
+	    devs[1]->subdevice == 0x8432);
+
+	/* Test that the lines of each driver are merged */
+	ATF_REQUIRE((devs = get_usb_devs(list)) != NULL);
+	ATF_CHECK(devs[1] == NULL);
+	ATF_CHECK(devs[0]->bus == BUS_TYPE_USB);
+	ATF_CHECK(devs[0]->vendor == 0x8564 && devs[0]->device == 0x1000);
+	ATF_REQUIRE(devs[0]->nifaces == 1);
+	ATF_CHECK(devs[0]->iface[0].class == 0x08);
+	ATF_CHECK(devs[0]->iface[0].protocol == 0x50);
+	free_devlist(list);
+}
+
+ATF_TC_WITHOUT_HEAD(resync_devs);
+ATF_TC_BODY(resync_devs, tc)
+{
+	FILE	  *fp;
+	devinfo_t *dev, *kept;
+
+	ATF_REQUIRE((fp = fopen("resync.test", "w")) != NULL);
+	(void)fprintf(fp,
+	    "vendor=8564 product=1000 class=00 subclass=00 bus=USB "
+	    "ugen=ugen0.2 Flash drive: umass\n"
+	    "vendor=0781 product=5567 class=00 subclass=00 bus=USB "
+	    "ugen=ugen0.3 Cruzer Blade: umass\n"
+	    "vendor=8086 product=2922 class=01 subclass=06 bus=PCI "
+	    "sel=pci0:0:31:2 SATA controller: ahci\n"
+	    "vendor=10ec product=8168 class=02 subclass=00 bus=PCI "
+	    "sel=pci0:2:0:0 Ethernet controller: re\n");
+	ATF_REQUIRE(fclose(fp) == 0);
+	ATF_REQUIRE(set_dev_backend("replay", "resync.test"));
+
+	open_drivers_db();
+	pnpindex = load_pnp_index();
+	ATF_REQUIRE((evloop = create_event_loop()) != NULL);
+	replay = true;
+	cfg = create_test_cfg("added, removed = \"\", \"\"\n"		    \
+			      "function on_add_device(dev)\n"		    \
+			      "  added = added .. "			    \
+			      "string.format(\"%04x \", dev.vendor)\n"	    \
+			      "  return 0\n"				    \
+			      "end\n"					    \
+			      "function on_remove_device(dev)\n"	    \
+			      "  removed = removed .. "			    \
+			      "string.format(\"%04x \", dev.vendor)\n"	    \
+			      "  return 0\n"				    \
+			      "end\n");
+	devlist = create_devlist();
+	kept = add_usb_dev(devlist, "ugen0.2", "A1", 0x8564, 0x1000, 0, 0);
+	ATF_REQUIRE(kept != NULL);
+	ATF_REQUIRE(add_usb_dev(devlist, "ugen0.3", NULL, 0x046d, 0xc52b,
+	    0, 0) != NULL);
+	ATF_REQUIRE(add_usb_dev(devlist, "ugen0.5", NULL, 0x0781, 0x5567,
+	    0, 0) != NULL);
+	ATF_REQUIRE((dev = add_pci_dev(devlist, "pci0:0:31:2")) != NULL);
+	dev->vendor = 0x8086;
+	dev->device = 0x2922;
+	nprocessed = devlist->ndevs;
+
+	/*
+	 * Test that only the devices which are gone, or whose location was
+	 * reused by another device, are removed, and only the new ones are
+	 * processed. The serial number is unknown to the backend, so the
+	 * device at ugen0.2 is the same.
+	 */
+	resync_devs(monotonic_ns());
+	ATF_CHECK_EQ(4, devlist->ndevs);
+	ATF_CHECK_EQ(4, nprocessed);
+	ATF_CHECK(find_dev(devlist, "ugen0.2") == kept);
+	ATF_CHECK(find_dev(devlist, "ugen0.5") == NULL);
+	ATF_REQUIRE((dev = find_dev(devlist, "ugen0.3")) != NULL);
+	ATF_CHECK(dev->vendor == 0x0781 && dev->device == 0x5567);
+	ATF_REQUIRE((dev = find_dev(devlist, "pci0:2:0:0")) != NULL);
+	ATF_CHECK(dev->vendor == 0x10ec && dev->device == 0x8168);
+	ATF_CHECK(find_dev(devlist, "pci0:0:31:2") != NULL);
+	check_cfg_str(cfg, "removed", "046d 0781 ");
+	check_cfg_str(cfg, "added", "10ec 0781 ");
+
+	/* Test that a resync without changes does nothing */
+	resync_devs(monotonic_ns());
+	ATF_CHECK_EQ(4, devlist->ndevs);
+	ATF_CHECK_EQ(4, nprocessed);
+	check_cfg_str(cfg, "removed", "046d 0781 ");
+	check_cfg_str(cfg, "added", "10ec 0781 ");
+	free_devlist(devlist);
+	devlist = NULL;
+	free_test_cfg(cfg);
+	cfg = NULL;
+	free_event_loop(evloop);
+	evloop = NULL;
+}
+
+ATF_TC_WITHOUT_HEAD(is_same_dev);
+ATF_TC_BODY(is_same_dev, tc)
+{
+	devinfo_t a, b;
+
+	(void)memset(&a, 0, sizeof(a));
+	(void)memset(&b, 0, sizeof(b));
+	a.vendor = b.vendor = 0x8564;
+	a.device = b.device = 0x1000;
+	ATF_CHECK(is_same_dev(&a, &b));
+	a.serial = "A1";
+	ATF_CHECK(is_same_dev(&a, &b));
+	ATF_CHECK(is_same_dev(&b, &a));
+	b.serial = "A1";
+	ATF_CHECK(is_same_dev(&a, &b));
+	b.serial = "A2";
+	ATF_CHECK(!is_same_dev(&a, &b));
+	b.serial = NULL;
+	b.device = 0x1001;
+	ATF_CHECK(!is_same_dev(&a, &b));
+	b.device = 0x1000;
+	b.vendor = 0x8565;
+	ATF_CHECK(!is_same_dev(&a, &b));
+}
+
+/*
+ * Replays the given inventory, and writes the -i output of the devices
+ * to outpath. Returns the device list.
+ */
+static devlist_t *
+replay_snapshot_file(const char *path, const char *outpath)
+{
+	FILE	  *fp;
+	devinfo_t **dev;
+	devlist_t *list;
+
+	ATF_REQUIRE(set_dev_backend("replay", path));
+	ATF_REQUIRE((list = init_devlist()) != NULL);
+	ATF_REQUIRE((fp = fopen(outpath, "w")) != NULL);
+	for (dev = list->devs; *dev != NULL; dev++)
+		print_inventory(fp, *dev);
+	ATF_REQUIRE(fclose(fp) == 0);
+
+	return (list);
+}
+
+ATF_TC_WITHOUT_HEAD(replay_inventory);
+ATF_TC_BODY(replay_inventory, tc)
+{
+	FILE	  *fp;
+	char	  out1[4096], out2[4096];
+	size_t	  len1, len2;
+	devlist_t *list;
+
+	ATF_REQUIRE((fp = fopen("inventory.test", "w")) != NULL);
+	(void)fprintf(fp,
+	    "vendor=8086 product=2922 subvendor=8086 subdevice=7270 "
+	    "revision=02 class=01 subclass=06 bus=PCI sel=pci0:0:31:2 "
+	    "SATA controller: ahci\n"
+	    "vendor=10ec product=8168 subvendor=1043 subdevice=8432 "
+	    "revision=0c class=02 subclass=00 bus=PCI sel=pci0:3:0:0 "
+	    "Ethernet controller:\n"
+	    "vendor=10ec product=8168 subvendor=1043 subdevice=8432 "
+	    "revision=0c class=02 subclass=00 bus=PCI sel=pci0:4:0:0 "
+	    "Ethernet controller:\n"
+	    "vendor=8564 product=1000 class=00 subclass=00 bus=USB "
+	    "ugen=ugen0.2 Flash drive: umass\n"
+	    "vendor=8564 product=1000 ifclass=08 ifsubclass=06 protocol=50 "
+	    "bus=USB\n"
+	    "vendor=8564 product=1000 class=00 subclass=00 bus=USB "
+	    "ugen=ugen0.3 Flash drive: umass\n"
+	    "vendor=8564 product=1000 ifclass=08 ifsubclass=06 protocol=50 "
+	    "bus=USB\n");
+	(void)fclose(fp);
+
+	/*
+	 * Test that identical devices, and devices without drivers, are
+	 * kept, along with all IDs and the locations.
+	 */
+	list = replay_snapshot_file("inventory.test", "inventory.out1");
+	ATF_REQUIRE(list->ndevs == 5);
+	ATF_CHECK_STREQ("pci0:0:31:2", list->devs[0]->pcisel);
+	ATF_CHECK(list->devs[0]->revision == 0x02);
+	ATF_CHECK(list->devs[0]->subdevice == 0x7270);
+	ATF_CHECK_STREQ("pci0:4:0:0", list->devs[2]->pcisel);
+	ATF_CHECK_STREQ("ugen0.2", list->devs[3]->ugen);
+	ATF_CHECK_STREQ("ugen0.3", list->devs[4]->ugen);
+	ATF_CHECK(list->devs[3]->nifaces == 1 && list->devs[4]->nifaces == 1);
+	free_devlist(list);
+
+	/* Test that the -i output replays to the same devices. */
+	list = replay_snapshot_file("inventory.out1", "inventory.out2");
+	ATF_CHECK(list->ndevs == 5);
+	free_devlist(list);
+	ATF_REQUIRE((fp = fopen("inventory.out1", "r")) != NULL);
+	len1 = fread(out1, 1, sizeof(out1), fp);
+	(void)fclose(fp);
+	ATF_REQUIRE((fp = fopen("inventory.out2", "r")) != NULL);
+	len2 = fread(out2, 1, sizeof(out2), fp);
+	(void)fclose(fp);
+	ATF_CHECK(len1 > 0 && len1 == len2 && memcmp(out1, out2, len1) == 0);
+}
+
 ATF_TC_WITHOUT_HEAD(match_kmod_name);
 ATF_TC_BODY(match_kmod_name, tc)
 {
@@ -120,8 +1432,9 @@ ATF_TC_BODY(match_kmod_name, tc)
 ATF_TC_WITHOUT_HEAD(get_devdescr);
 ATF_TC_BODY(get_devdescr, tc)
 {
-	char	  *descr1, *descr2;
-	devinfo_t testdev_pci1, testdev_pci2;
+	char	   *descr1, *descr2;
+	const char *descr3;
+	devinfo_t  testdev_pci1, testdev_pci2;
 
 	open_drivers_db();
 	(void)memset(&testdev_pci1, 0, sizeof(testdev_pci1));
@@ -153,6 +1466,15 @@ ATF_TC_BODY(get_devdescr, tc)
 	ATF_REQUIRE(descr2 != NULL);
 	ATF_CHECK_STREQ_MSG(descr2, "Trident Microsystems GUI Accelerator",
 	    "descr2 == \"%s\"", descr2);
+
+	/*
+	 * Test that the description is looked up on first use, and kept.
+	 */
+	ATF_CHECK(testdev_pci2.descr == NULL);
+	descr3 = resolve_devdescr(&testdev_pci2);
+	ATF_REQUIRE(descr3 != NULL);
+	ATF_CHECK_STREQ("Trident Microsystems GUI Accelerator", descr3);
+	ATF_CHECK(resolve_devdescr(&testdev_pci2) == descr3);
 }
 
 ATF_TC_WITHOUT_HEAD(create_exclude_list);
@@ -174,6 +1496,27 @@ ATF_TP_ADD_TCS(tp)
 {
 	ATF_TP_ADD_TC(tp, parse_devd_event);
 	ATF_TP_ADD_TC(tp, find_driver_db);
+	ATF_TP_ADD_TC(tp, match_ctx);
+	ATF_TP_ADD_TC(tp, match_devlist);
+	ATF_TP_ADD_TC(tp, pnp_index);
+	ATF_TP_ADD_TC(tp, drivers_db_image);
+	ATF_TP_ADD_TC(tp, builtin_drivers_db);
+	ATF_TP_ADD_TC(tp, overlay_drivers_db);
+	ATF_TP_ADD_TC(tp, dev_cache);
+	ATF_TP_ADD_TC(tp, devlist);
+	ATF_TP_ADD_TC(tp, usb_events);
+	ATF_TP_ADD_TC(tp, pci_events);
+	ATF_TP_ADD_TC(tp, usb_detach);
+	ATF_TP_ADD_TC(tp, attach_delay);
+	ATF_TP_ADD_TC(tp, file_watch);
+	ATF_TP_ADD_TC(tp, event_loop);
+	ATF_TP_ADD_TC(tp, devd_reader);
+	ATF_TP_ADD_TC(tp, msg_queue);
+	ATF_TP_ADD_TC(tp, sysfs_backend);
+	ATF_TP_ADD_TC(tp, replay_backend);
+	ATF_TP_ADD_TC(tp, resync_devs);
+	ATF_TP_ADD_TC(tp, is_same_dev);
+	ATF_TP_ADD_TC(tp, replay_inventory);
 	ATF_TP_ADD_TC(tp, match_kmod_name);
 	ATF_TP_ADD_TC(tp, get_devdescr);
 	ATF_TP_ADD_TC(tp, create_exclude_list);